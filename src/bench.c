@@ -0,0 +1,446 @@
+// NOTE: Needed for clock_gettime with -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "lookup_tables.c"
+#include "math/mathlib.h"
+#include "renderer/renderlib.h"
+#include "loader/loaderlib.h"
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+#define BENCH_WIDTH 640
+#define BENCH_HEIGHT 360
+#define BENCH_FRAME_COUNT 300
+#define BENCH_WARMUP_FRAME_COUNT 10
+#define BENCH_ENTITY_COUNT_MAX 64
+#define BENCH_TINT_COUNT 3
+// Scale of the instances relative to the mesh, they are laid out on a grid
+// one scaled bounding sphere diameter apart
+#define BENCH_INSTANCE_SCALE 0.25f
+
+// The scripted animation advances by a fixed step per frame, so every run
+// renders exactly the same frames regardless of how long they take
+#define BENCH_FRAME_TIME (1.0f / 60.0f)
+// Seconds per orbit of the camera around the scene
+#define BENCH_ORBIT_TIME 10.0f
+#define BENCH_ORBIT_RADIUS 56.2f
+#define BENCH_ORBIT_HEIGHT 38.2f
+#define BENCH_ORBIT_PITCH 25.0f
+
+// S T R U C T   D E F I N I T I O N S /////////////////////////////////////////
+
+typedef struct bench_options_t {
+	i32 width;
+	i32 height;
+	i32 frame_count;
+	i32 warmup_frame_count;
+	i32 thread_count;
+	i32 pipelined;
+	raster_mode_t raster_mode;
+	texture_filter_t filter;
+	framebuffer_layout_t layout;
+	i32 entity_count;
+	i32 instance_count;
+	const char* obj_paths[BENCH_ENTITY_COUNT_MAX];
+	const char* texture_paths[BENCH_ENTITY_COUNT_MAX];
+	const char* image_path;
+} bench_options_t;
+
+// G L O B A L   V A R I A B L E S /////////////////////////////////////////////
+
+static color_rgba_t color_black = color_rgba(0.086f, 0.086f, 0.086f, 1.0f);
+static color_rgba_t color_red = color_rgba(0.819f, 0.309f, 0.172f, 1.0f);
+
+static renderer_t renderer = { 0 };
+static render_entity3d_t entities[BENCH_ENTITY_COUNT_MAX] = { 0 };
+static texture_t textures[BENCH_ENTITY_COUNT_MAX] = { 0 };
+static material3d_t materials[BENCH_ENTITY_COUNT_MAX] = { 0 };
+static render_instance_batch3d_t instance_batch = { 0 };
+
+static color_rgba_t bench_tints[BENCH_TINT_COUNT] = {
+	color_rgba(1.0f, 1.0f, 1.0f, 1.0f),
+	color_rgba(1.0f, 0.7f, 0.5f, 1.0f),
+	color_rgba(0.6f, 0.8f, 1.0f, 1.0f)
+};
+
+static const char* fortress_obj_paths[] = {
+	"assets/fortress.obj",
+	"assets/fortress_environment.obj",
+	"assets/fortress_sand.obj",
+	"assets/fortress_sea.obj",
+	"assets/fortress_sky.obj"
+};
+
+static const char* fortress_texture_paths[] = {
+	"assets/fortress_diffuse.tga",
+	"assets/fortress_environment_diffuse.tga",
+	"assets/fortress_sand_diffuse.tga",
+	"assets/fortress_sea_diffuse.tga",
+	"assets/fortress_sky_diffuse.tga"
+};
+
+// O P T I O N   F U N C T I O N S /////////////////////////////////////////////
+
+static inline void bench_usage() {
+	fprintf(stderr,
+		"Usage: bench [options]\n"
+		"\t-w <width>          Framebuffer width (%d)\n"
+		"\t-h <height>         Framebuffer height (%d)\n"
+		"\t-f <frames>         Measured frames (%d)\n"
+		"\t-W <frames>         Warmup frames (%d)\n"
+		"\t-t <threads>        0 serial, -1 one per CPU (-1)\n"
+		"\t-p <0|1>            Pipelined tiled renderer (0)\n"
+		"\t-m <scanline|edge|visibility> Raster mode (edge)\n"
+		"\t-F <nearest|bilinear|trilinear> Texture filter (nearest)\n"
+		"\t-l <linear|tiled>   Framebuffer layout (linear)\n"
+		"\t-e <obj> <tga>      Adds an entity, replaces the fortress scene\n"
+		"\t-I <count>          Tinted instances of the first entity (0)\n"
+		"\t-o <ppm>            Writes the last frame to an image\n"
+		"The results are printed as one JSON object on the last line.\n",
+		BENCH_WIDTH, BENCH_HEIGHT, BENCH_FRAME_COUNT,
+		BENCH_WARMUP_FRAME_COUNT);
+} // bench_usage
+
+// Returns 0 if the arguments are invalid
+static inline i32 bench_parse_options(bench_options_t* options, int argc,
+	char** argv)
+{
+	options->width = BENCH_WIDTH;
+	options->height = BENCH_HEIGHT;
+	options->frame_count = BENCH_FRAME_COUNT;
+	options->warmup_frame_count = BENCH_WARMUP_FRAME_COUNT;
+	options->thread_count = RENDERER_THREAD_COUNT_AUTO;
+	options->pipelined = 0;
+	options->raster_mode = RASTER_MODE_EDGE;
+	options->filter = TEXTURE_FILTER_NEAREST;
+	options->layout = FRAMEBUFFER_LAYOUT_LINEAR;
+	options->entity_count = 0;
+	options->instance_count = 0;
+	options->image_path = NULL;
+
+	for (i32 i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		i32 remaining = argc - i - 1;
+		if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0') return 0;
+		if (remaining < 1) return 0;
+
+		const char* value = argv[++i];
+		switch (arg[1]) {
+			case 'w': options->width = atoi(value); break;
+			case 'h': options->height = atoi(value); break;
+			case 'f': options->frame_count = atoi(value); break;
+			case 'W': options->warmup_frame_count = atoi(value); break;
+			case 't': options->thread_count = atoi(value); break;
+			case 'p': options->pipelined = atoi(value) != 0; break;
+			case 'o': options->image_path = value; break;
+			case 'I': options->instance_count = atoi(value); break;
+			case 'm':
+				if (strcmp(value, "scanline") == 0)
+					options->raster_mode = RASTER_MODE_SCANLINE;
+				else if (strcmp(value, "edge") == 0)
+					options->raster_mode = RASTER_MODE_EDGE;
+				else if (strcmp(value, "visibility") == 0)
+					options->raster_mode = RASTER_MODE_VISIBILITY;
+				else return 0;
+				break;
+			case 'F':
+				if (strcmp(value, "nearest") == 0)
+					options->filter = TEXTURE_FILTER_NEAREST;
+				else if (strcmp(value, "bilinear") == 0)
+					options->filter = TEXTURE_FILTER_BILINEAR;
+				else if (strcmp(value, "trilinear") == 0)
+					options->filter = TEXTURE_FILTER_TRILINEAR;
+				else return 0;
+				break;
+			case 'l':
+				if (strcmp(value, "linear") == 0)
+					options->layout = FRAMEBUFFER_LAYOUT_LINEAR;
+				else if (strcmp(value, "tiled") == 0)
+					options->layout = FRAMEBUFFER_LAYOUT_TILED;
+				else return 0;
+				break;
+			case 'e':
+				if (remaining < 2) return 0;
+				if (options->entity_count == BENCH_ENTITY_COUNT_MAX) return 0;
+				options->obj_paths[options->entity_count] = value;
+				options->texture_paths[options->entity_count] = argv[++i];
+				options->entity_count++;
+				break;
+			default: return 0;
+		}
+	}
+
+	if (options->entity_count == 0) {
+		options->entity_count = sizeof fortress_obj_paths /
+			sizeof *fortress_obj_paths;
+		for (i32 i = 0; i < options->entity_count; i++) {
+			options->obj_paths[i] = fortress_obj_paths[i];
+			options->texture_paths[i] = fortress_texture_paths[i];
+		}
+	}
+
+	return options->width > 0 && options->height > 0 &&
+		options->frame_count > 0 && options->warmup_frame_count >= 0 &&
+		options->instance_count >= 0;
+} // bench_parse_options
+
+// R E N D E R E R   F U N C T I O N S /////////////////////////////////////////
+
+// Returns 0 if a file of the scene can not be loaded
+static inline i32 bench_init(bench_options_t* options) {
+	framebuffer_t* fb = &renderer.framebuffer;
+	fb->layout = options->layout;
+	framebuffer_resize(fb, options->width, options->height);
+	fb->image_format = IMAGE_FORMAT_ARGB;
+
+	renderer.clear_color = color_red;
+	renderer.wireframe_color = color_black;
+	renderer.thread_count = options->thread_count;
+	renderer.pipelined = options->pipelined;
+	renderer.raster_mode = options->raster_mode;
+	renderer.entity_count = options->entity_count;
+
+	renderer.ambient_light = color_rgba(
+		0.4f, 0.4f, 0.4f, 1.0f
+	);
+	renderer.directional_light.direction = vector4d(
+		1.0f, -1.0f, 1.0f
+	);
+	renderer.directional_light.diffuse = color_rgba(
+		1.0f, 1.0f, 1.0f, 1.0f
+	);
+
+	renderer.camera.fov = 90.0f;
+	renderer.camera.z_near = 0.5f;
+	renderer.camera.z_far = 2000.0f;
+
+	renderer_init(&renderer);
+	thread_pool_t* pool = renderer_thread_pool(&renderer);
+
+	transform4d_t transform = transform4d(
+		point4d(0.0f, 0.0f, 0.0f),
+		vector4d(0.0f, 0.0f, 0.0f),
+		vector4d(2.0f, 2.0f, 2.0f)
+	);
+
+	for (i32 i = 0; i < options->entity_count; i++) {
+		render_entity3d_t* entity = render_entity_load_from_obj_cached(
+			options->obj_paths[i], &transform, i, pool);
+		texture_t* texture = texture_load_from_tga(options->texture_paths[i],
+			pool);
+		if (entity == NULL || texture == NULL) return 0;
+
+		entities[i] = *entity;
+		textures[i] = *texture;
+		textures[i].filter = options->filter;
+		materials[i].texture_index = i;
+		free(entity);
+		free(texture);
+	}
+	renderer.entities = entities;
+	renderer.textures = textures;
+	renderer.materials = materials;
+
+	// NOTE: A square grid centered at the origin, the tints alternate
+	if (options->instance_count > 0) {
+		render_entity3d_t* entity = &entities[0];
+		i32 side = 1;
+		while (side * side < options->instance_count) side++;
+		f32 spacing = 2.0f * entity->bounds_radius * BENCH_INSTANCE_SCALE;
+		f32 offset = (side - 1) * 0.5f;
+
+		instance_batch.entity = entity;
+		instance_batch.instance_count = options->instance_count;
+		instance_batch.instances = malloc(sizeof *instance_batch.instances *
+			options->instance_count);
+		for (i32 i = 0; i < options->instance_count; i++) {
+			render_instance3d_t* instance = &instance_batch.instances[i];
+			instance->transform = transform4d(
+				point4d((i % side - offset) * spacing, 0.0f,
+					(i / side - offset) * spacing),
+				vector4d(0.0f, 0.0f, 0.0f),
+				vector4d(BENCH_INSTANCE_SCALE, BENCH_INSTANCE_SCALE,
+					BENCH_INSTANCE_SCALE)
+			);
+			instance->tint = bench_tints[i % BENCH_TINT_COUNT];
+		}
+		renderer.instance_batches = &instance_batch;
+		renderer.instance_batch_count = 1;
+	}
+
+	matrix4x4_projection(&renderer.projection_matrix,
+		renderer.camera.z_near, renderer.camera.z_far,
+		renderer.camera.fov, fb->width, fb->height);
+
+	return 1;
+} // bench_init
+
+static inline void bench_shut(bench_options_t* options) {
+	renderer_shut(&renderer);
+	free(instance_batch.instances);
+	for (i32 i = 0; i < options->entity_count; i++) {
+		render_entity_free(&entities[i]);
+		texture_free(&textures[i]);
+	}
+	framebuffer_free(&renderer.framebuffer);
+} // bench_shut
+
+// Places the camera and the entities at time t of the scripted animation;
+// the camera circles the scene while looking at its center
+static inline void bench_animate(bench_options_t* options, f32 t) {
+	f32 yaw = 360.0f * t / BENCH_ORBIT_TIME;
+	renderer.camera.position = point4d(
+		-BENCH_ORBIT_RADIUS * gf_sin(yaw),
+		BENCH_ORBIT_HEIGHT,
+		-BENCH_ORBIT_RADIUS * gf_cos(yaw)
+	);
+	renderer.camera.direction = vector4d(BENCH_ORBIT_PITCH, yaw, 0.0f);
+
+	for (i32 i = 0; i < options->entity_count; i++)
+		entities[i].transform.rotation.y = -2.0f * t;
+	for (i32 i = 0; i < options->instance_count; i++)
+		instance_batch.instances[i].transform.rotation.y = -2.0f * t;
+} // bench_animate
+
+// T I M I N G   F U N C T I O N S /////////////////////////////////////////////
+
+static inline f64 bench_time_ms() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+} // bench_time_ms
+
+static inline int bench_compare_f64(const void* a, const void* b) {
+	f64 x = *(const f64 *) a;
+	f64 y = *(const f64 *) b;
+	return (x > y) - (x < y);
+} // bench_compare_f64
+
+// Nearest rank percentile of sorted values, p is in [0, 1]
+static inline f64 bench_percentile(f64* sorted, i32 count, f64 p) {
+	i32 rank = (i32) (p * count + 0.999999);
+	if (rank < 1) rank = 1;
+	if (rank > count) rank = count;
+	return sorted[rank - 1];
+} // bench_percentile
+
+// FNV-1a hash of the presented image to detect changes of the output, it
+// does not depend on the framebuffer layout
+static inline u64 bench_hash_image(u32* image, i32 width, i32 height) {
+	u64 hash = 14695981039346656037ull;
+	for (i32 i = 0; i < width * height; i++) {
+		hash ^= image[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+} // bench_hash_image
+
+static inline void bench_write_image(u32* image, i32 width, i32 height,
+	const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not Write Image: %s!\n", path);
+		return;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	for (i32 i = 0; i < width * height; i++) {
+		u32 c = image[i];
+		u8 rgb[3] = { (c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF };
+		fwrite(rgb, 1, sizeof rgb, file);
+	}
+	fclose(file);
+} // bench_write_image
+
+// M A I N   F U N C T I O N ///////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+	bench_options_t options;
+	if (!bench_parse_options(&options, argc, argv)) {
+		bench_usage();
+		return 1;
+	}
+
+	f64 load_start = bench_time_ms();
+	if (!bench_init(&options)) {
+		fprintf(stderr, "Could not Load Scene!\n");
+		return 1;
+	}
+	f64 load_ms = bench_time_ms() - load_start;
+
+	framebuffer_t* fb = &renderer.framebuffer;
+	render_stats_t stats;
+	render_stats_clear(&stats);
+	f64* frame_ms = malloc(sizeof *frame_ms * options.frame_count);
+	// NOTE: Stands in for the window surface, the detiling is part of the
+	//       measured frame like it is in the demo
+	u32* image = malloc(sizeof *image * fb->width * fb->height);
+	i32 total_frame_count = options.warmup_frame_count + options.frame_count;
+	for (i32 i = 0; i < total_frame_count; i++) {
+		bench_animate(&options, i * BENCH_FRAME_TIME);
+		f64 start = bench_time_ms();
+		renderer_loop(&renderer);
+		framebuffer_detile(fb, image, fb->width);
+		f64 end = bench_time_ms();
+		if (i >= options.warmup_frame_count) {
+			frame_ms[i - options.warmup_frame_count] = end - start;
+			render_stats_merge(&stats, &renderer.stats);
+		}
+	}
+
+	// NOTE: The pipelined renderer is one frame behind, the last frame is
+	//       rasterized outside of the measurement so the hash matches
+	if (renderer.packet_pending) {
+		renderer_flush(&renderer);
+		framebuffer_detile(fb, image, fb->width);
+	}
+
+	f64 total_ms = 0.0;
+	for (i32 i = 0; i < options.frame_count; i++)
+		total_ms += frame_ms[i];
+	qsort(frame_ms, options.frame_count, sizeof *frame_ms, bench_compare_f64);
+
+	if (options.image_path)
+		bench_write_image(image, fb->width, fb->height, options.image_path);
+
+	f64 mean_ms = total_ms / options.frame_count;
+	printf("{\"width\": %d, \"height\": %d, \"threads\": %d, "
+		"\"frames\": %d, \"load_ms\": %.3f, \"min_ms\": %.3f, "
+		"\"median_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, "
+		"\"max_ms\": %.3f, \"mean_ms\": %.3f, \"fps\": %.2f, "
+		"\"mpixels_per_s\": %.2f, \"hash\": \"%016llx\"",
+		fb->width, fb->height, renderer.thread_count, options.frame_count,
+		load_ms, frame_ms[0],
+		bench_percentile(frame_ms, options.frame_count, 0.5),
+		bench_percentile(frame_ms, options.frame_count, 0.95),
+		bench_percentile(frame_ms, options.frame_count, 0.99),
+		frame_ms[options.frame_count - 1], mean_ms,
+		1000.0 / mean_ms,
+		(f64) fb->width * fb->height / (mean_ms * 1000.0),
+		(unsigned long long) bench_hash_image(image, fb->width, fb->height));
+#ifdef RENDERER_STATS
+	// NOTE: Mean counters per frame, overdraw is written per screen pixel
+	printf(", \"stats\": {");
+	for (i32 i = 0; i < RENDER_STATS_COUNTER_COUNT; i++) {
+		printf("\"%s\": %.1f, ", render_stats_counter_name(i),
+			(f64) stats.counters[i] / options.frame_count);
+	}
+	printf("\"overdraw\": %.3f}",
+		(f64) stats.counters[RENDER_STATS_PIXELS_WRITTEN] /
+		options.frame_count / (fb->width * fb->height));
+#endif
+	printf("}\n");
+
+	free(frame_ms);
+	free(image);
+	bench_shut(&options);
+
+	return 0;
+} // main
@@ -1,14 +1,18 @@
+// NOTE: Needed for clock_gettime with -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include <SDL.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include "lookup_tables.c"
 #include "math/mathlib.h"
 #include "renderer/renderlib.h"
-#include "time.h"
+#include "loader/loaderlib.h"
 
 // D E F I N E S ///////////////////////////////////////////////////////////////
 
@@ -22,6 +26,9 @@
 #define TEXTURE_COUNT 5
 #define MATERIAL_COUNT TEXTURE_COUNT
 
+// NOTE: One image is presented while the next frame is detiled into the other
+#define PRESENT_IMAGE_COUNT 2
+
 // S T R U C T   D E F I N I T I O N S /////////////////////////////////////////
 
 typedef struct platform_state_t {
@@ -33,12 +40,43 @@ typedef struct platform_state_t {
 	int32_t quit;
 } platform_state_t;
 
+// NOTE: A row-major copy of a finished frame. The size is the size of the
+//       framebuffer when the frame was rendered, which may lag behind the
+//       window while it is resized.
+typedef struct present_image_t {
+	uint32_t* pixels;
+	int32_t width;
+	int32_t height;
+} present_image_t;
+
+// NOTE: The render thread rasterizes frames and publishes them as ready, the
+//       main thread presents them. The render thread never waits for the
+//       present, it overwrites a ready frame the main thread did not pick up
+//       yet instead. Resizes are posted by the main thread and applied by the
+//       render thread between two frames. Everything but the pixels of the
+//       images is guarded by the mutex.
+typedef struct present_state_t {
+	pthread_t render_thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t ready_cond;
+	present_image_t images[PRESENT_IMAGE_COUNT];
+	// Index of the image waiting to be presented or -1
+	int32_t ready;
+	// Index of the image the main thread is presenting or -1
+	int32_t presenting;
+	// Size the framebuffer has to be resized to or 0
+	int32_t resize_width;
+	int32_t resize_height;
+	int32_t quit;
+} present_state_t;
+
 // G L O B A L   V A R I A B L E S /////////////////////////////////////////////
 
 static color_rgba_t color_black = color_rgba(0.086f, 0.086f, 0.086f, 1.0f);
 static color_rgba_t color_red = color_rgba(0.819f, 0.309f, 0.172f, 1.0f);
 
 static platform_state_t ps = { 0 };
+static present_state_t present = { 0 };
 static renderer_t renderer = { 0 };
 static render_entity3d_t entities[RENDER_ENTITY_COUNT] = { 0 };
 static texture_t textures[TEXTURE_COUNT] = { 0 };
@@ -64,321 +102,11 @@ static const char* texture_paths[TEXTURE_COUNT] = {
 
 static inline void quit();
 
-// D Y N A M I C   A R R A Y ///////////////////////////////////////////////////
-
-typedef struct darray_header_t {
-	int size;
-	int capacity;
-} darray_header_t;
-
-#define darray(type) type*
-#define darray_init(array, size) darray_init_impl((int) sizeof *array, (int) size)
-#define darray_head(array) (((darray_header_t *) array) - 1)
-#define darray_size(array) (array == NULL ? 0 : darray_head(array)->size)
-#define darray_capacity(array) (array == NULL ? 0 : darray_head(array)->capacity)
-#define darray_empty(array) (darray_size(array) == 0)
-#define darray_full(array) (darray_size(array) == darray_capacity(array))
-#define darray_clear(array) darray_head(array)->size = 0
-#define darray_free(array) darray_free_impl(array)
-#define darray_resize(array, new_size) darray_resize_impl(array, (int) new_size, (int) sizeof *array)
-#define darray_push(array, item) \
-	do { \
-		darray_header_t* head = darray_head(array); \
-		if (darray_full(array)) { \
-			array = darray_resize(array, head->capacity * 2); \
-			head = darray_head(array); \
-		} \
-		*(array + head->size) = item; \
-		head->size++; \
-	} while (0)
-// TODO: Return the removed value
-#define darray_pop(array) (darray_head(array)->size -= 1)
-
-static inline void* darray_init_impl(int item_size, int arr_size) {
-	darray_header_t* head = malloc(sizeof(darray_header_t) + arr_size * item_size);
-	head->size = 0;
-	head->capacity = arr_size;
-	return ++head;
-} // darray_init_impl
-
-static inline void darray_free_impl(void* array) {
-	free(darray_head(array));
-} // darray_free_impl
-
-static inline void* darray_resize_impl(void* array, int new_size, int item_size) {
-	if (array == NULL)
-		return darray_init_impl(item_size, new_size);
-
-	darray_header_t* head = darray_head(array);
-	head = realloc(head, sizeof(darray_header_t) + new_size * item_size);
-	head->capacity = new_size;
-	return ++head;
-} // darray_resize_impl
-
-// F I L E   F U N C T I O N S /////////////////////////////////////////////////
-
-typedef struct file_info_t {
-	u8* buffer;
-	size_t buffer_size;
-	size_t bytes_read;
-} file_info_t;
-
-static inline file_info_t file_read_sync(const char* filepath) {
-	file_info_t file_info = { 0 };
-	FILE* file = fopen(filepath, "rb");
-	if (!file) {
-		printf("Could not Load File: %s!\n", filepath);
-		return file_info;
-	}
-
-	fseek(file, 0L, SEEK_END);
-	size_t buffer_size = ftell(file);
-	u8* buffer = malloc(sizeof(u8) * buffer_size);
-	rewind(file);
-
-	size_t bytes_read = fread(buffer, 1, buffer_size, file);
-
-	i32 error = ferror(file);
-
-	fclose(file);
-
-	if (error) {
-		printf("Error Reading File!\n\tError Code: %d!\n", error);
-		return file_info;
-	}
-
-	file_info.buffer = buffer;
-	file_info.buffer_size = buffer_size;
-	file_info.bytes_read = bytes_read;
-
-	return file_info;
-} // file_read_sync
-
-// T G A   F U N C T I O N S ///////////////////////////////////////////////////
-
-#define TGA_VERTICAL_FLIP_BIT 0x20
-#define TGA_HORIZONTAL_FLIP_BIT 0x10
-
-#pragma pack(push, 1)
-typedef struct tga_header_t {
-	u8 id_length;
-	u8 color_map_type;
-	u8 image_type;
-	u16 color_map_start;
-	u16 color_map_length;
-	u8 color_map_depth;
-	u16 x_origin;
-	u16 y_origin;
-	u16 width;
-	u16 height;
-	u8 bits_per_pixel;
-	u8 image_descriptor;
-} tga_header_t;
-#pragma pack(pop)
-
-// TODO: Add support for missing image types
-// NOTE: Only uncompressed tga files supported
-static inline texture_t* texture_load_from_tga(const char* filepath) {
-	printf("Loading Image File: %s\n", filepath);
-
-	texture_t* tex = malloc(sizeof(texture_t));
-
-	file_info_t file = file_read_sync(filepath);
-	tga_header_t* header = (tga_header_t *) file.buffer;
-	printf("\tID Length: %d\n", header->id_length);
-	printf("\tColor Map Type: %d\n", header->color_map_type);
-	printf("\tImage Type: %d\n", header->image_type);
-	printf("\tColor Map Start: %d\n", header->color_map_start);
-	printf("\tColor Map Length: %d\n", header->color_map_length);
-	printf("\tColor Map Depth: %d\n", header->color_map_depth);
-	printf("\tX Origin: %d\n", header->x_origin);
-	printf("\tY Origin: %d\n", header->y_origin);
-	printf("\tWidth: %d\n", header->width);
-	printf("\tHeight: %d\n", header->height);
-	printf("\tBits per Pixel: %d\n", header->bits_per_pixel);
-	printf("\tImage Descriptor: %d\n", header->image_descriptor);
-
-	tex->width = header->width;
-	tex->height = header->height;
-	i32 size = tex->width * tex->height;
-	tex->data = malloc(sizeof *tex->data * size);
-	i32 bytes_per_pixel = header->bits_per_pixel >> 3;
-	u8* image_data = file.buffer + sizeof(tga_header_t);
-
-	if (header->image_type == 2 || header->image_type == 3) {
-		for (i32 i = 0; i < size; i++) {
-			if (bytes_per_pixel == 1) {
-				tex->data[i].b = image_data[i * bytes_per_pixel] / 255.0f;
-				tex->data[i].g = image_data[i * bytes_per_pixel] / 255.0f;
-				tex->data[i].r = image_data[i * bytes_per_pixel] / 255.0f;
-			} else {
-				tex->data[i].b = image_data[i * bytes_per_pixel] / 255.0f;
-				tex->data[i].g = image_data[i * bytes_per_pixel + 1] / 255.0f;
-				tex->data[i].r = image_data[i * bytes_per_pixel + 2] / 255.0f;
-			}
-			if (bytes_per_pixel == 4) {
-				tex->data[i].a = image_data[i * bytes_per_pixel + 3] / 255.0f;
-			} else {
-				tex->data[i].a = 1.0f;
-			}
-		}
-	}
-
-	u32 vertical_flip = header->image_descriptor & TGA_VERTICAL_FLIP_BIT;
-	u32 horizontal_flip = header->image_descriptor & TGA_HORIZONTAL_FLIP_BIT;
-	if (horizontal_flip) {
-		texture_flip_horizontal(tex);
-	}
-	if (vertical_flip) {
-		texture_flip_vertical(tex);
-	}
-
-	free(file.buffer);
-
-	printf("Loading Image File %s Finished\n", filepath);
-
-	return tex;
-} // texture_load_from_tga
-
-// O B J   F U N C T I O N S ///////////////////////////////////////////////////
-
-static inline render_entity3d_t* render_entity_load_from_obj(const char* filepath,
-	transform4d_t* transform, i32 material_index)
-{
-	printf("Loading OBJ File: %s\n", filepath);
-
-	render_entity3d_t* entity = malloc(sizeof(render_entity3d_t));
-	darray(point4d_t) vertices = darray_init(vertices, 4);
-	darray(point2d_t) texcoords = darray_init(texcoords, 4);
-	darray(vector4d_t) normals = darray_init(normals, 4);
-	darray(index3d_t) indices = darray_init(indices, 2);
-	darray(face3d_t) faces = darray_init(faces, 2);
-
-	FILE* file = fopen(filepath, "r");
-	if (file == NULL) {
-		printf("Could not Load File: %s!\n", filepath);
-		return NULL;
-	}
-
-	char c = fgetc(file);
-	while (!feof(file)) {
-		point4d_t v = point4d(0.0f, 0.0f, 0.0f);
-		point2d_t t = point2d(0.0f, 0.0f);
-		vector4d_t n = vector4d(0.0f, 0.0f, 0.0f);
-
-		if (c == 'v') {
-			c = fgetc(file);
-			if (c == ' ') { // Vertex
-				i32 num = fscanf(file, "%f %f %f\n", &v.x, &v.y, &v.z);
-				if (num != 3)
-					fprintf(stderr, "Error loading file!\n");
-				darray_push(vertices, v);
-			} else if (c == 't') { // Texture Coord
-				i32 num = fscanf(file, " %f %f\n", &t.u, &t.v);
-				if (num != 2)
-					fprintf(stderr, "Error loading file!\n");
-				darray_push(texcoords, t);
-			} else if (c == 'n') { // Normal
-				i32 num = fscanf(file, "%f %f %f\n", &n.x, &n.y,&n.z);
-				if (num != 3)
-					fprintf(stderr, "Error loading file!\n");
-				darray_push(normals, n);
-			}
-		} else if (c == 'f' && (c = fgetc(file)) == ' ') {
-			darray_clear(indices);
-			while (c != '\n') {
-				index3d_t index = { 0 };
-				i32 num = fscanf(file, "%d/%d/%d", &index.position, &index.texcoord, &index.normal);
-				if (num != 3)
-					fprintf(stderr, "Error loading file!\n");
-				// NOTE: In OBJ indices start with 1;
-				//       In renderer indices start with 0
-				index.position--;
-				index.texcoord--;
-				index.normal--;
-				darray_push(indices, index);
-				c = fgetc(file);
-			}
-			face3d_t face = { 0 };
-			face.index_count = darray_size(indices);
-			int index_array_size = sizeof *indices * face.index_count;
-			face.indices = malloc(index_array_size);
-			memcpy(face.indices, indices, index_array_size);
-			darray_push(faces, face);
-		} else {
-			while (c != '\n') {
-				c = fgetc(file);
-			}
-		}
-		c = fgetc(file);
-	}
-	fclose(file);
-
-	darray_free(indices);
-
-	printf("\tVertex Count: %d\n", darray_size(vertices));
-	entity->vertex_count = darray_size(vertices);
-	int vertex_array_size = sizeof *entity->vertices * entity->vertex_count;
-	entity->vertices = malloc(vertex_array_size);
-	memcpy(entity->vertices, vertices, vertex_array_size);
-	darray_free(vertices);
-
-	printf("\tTexcoord Count: %d\n", darray_size(texcoords));
-	entity->texcoord_count = darray_size(texcoords);
-	int texcoord_array_size = sizeof *entity->texcoords * entity->texcoord_count;
-	entity->texcoords = malloc(texcoord_array_size);
-	memcpy(entity->texcoords, texcoords, texcoord_array_size);
-	darray_free(texcoords);
-
-	printf("\tNormal Count: %d\n", darray_size(normals));
-	entity->normal_count = darray_size(normals);
-	int normal_array_size = sizeof *entity->normals * entity->normal_count;
-	entity->normals = malloc(normal_array_size);
-	memcpy(entity->normals, normals, normal_array_size);
-	darray_free(normals);
-
-	printf("\tFace Count: %d\n", darray_size(faces));
-	entity->face_count = darray_size(faces);
-	int face_array_size = sizeof *entity->faces * entity->face_count;
-	entity->faces = malloc(face_array_size);
-	memcpy(entity->faces, faces, face_array_size);
-	darray_free(faces);
-
-	entity->material_index = material_index;
-	entity->transform = *transform;
-
-	printf("Loading OBJ File %s Finished\n", filepath);
-	return entity;
-} // render_entity_load_from_obj
-
-static inline void render_entity_free(render_entity3d_t* entity) {
-	free(entity->vertices);
-	free(entity->texcoords);
-	free(entity->normals);
-	for (u32 i = 0; i < entity->face_count; i++) {
-		free(entity->faces[i].indices);
-	}
-	free(entity->faces);
-} // render_entity_free
-
 // R E N D E R E R   F U N C T I O N S /////////////////////////////////////////
 
 static inline void renderer_software_on_resize(int32_t width, int32_t height) {
-	ps.width = width;
-	ps.height = height;
-
 	framebuffer_t* fb = &renderer.framebuffer;
-	if (fb == NULL) return;
-	if (fb->color)
-		free(fb->color);
-	if (fb->depth)
-		free(fb->depth);
-
-	int32_t size = width * height;
-	fb->width = width;
-	fb->height = height;
-	fb->color = malloc(sizeof *fb->color * size);
-	fb->depth = malloc(sizeof *fb->depth * size);
+	framebuffer_resize(fb, width, height);
 
 	matrix4x4_projection(&renderer.projection_matrix,
 		renderer.camera.z_near, renderer.camera.z_far,
@@ -388,13 +116,13 @@ static inline void renderer_software_on_resize(int32_t width, int32_t height) {
 static inline void renderer_software_init() {
 	framebuffer_t* fb = &renderer.framebuffer;
 
-	int32_t size = ps.width * ps.height;
-	fb->width = ps.width;
-	fb->height = ps.height;
-	fb->color = malloc(sizeof *fb->color * size);
-	fb->depth = malloc(sizeof *fb->depth * size);
+	fb->layout = FRAMEBUFFER_LAYOUT_TILED;
+	framebuffer_resize(fb, ps.width, ps.height);
 
 	renderer.clear_color = color_red;
+	renderer.thread_count = RENDERER_THREAD_COUNT_AUTO;
+	renderer.pipelined = 1;
+	renderer.raster_mode = RASTER_MODE_EDGE;
 	renderer.entity_count = RENDER_ENTITY_COUNT;
 
 	renderer.ambient_light = color_rgba(
@@ -413,6 +141,10 @@ static inline void renderer_software_init() {
 	renderer.camera.z_near = 0.5f;
 	renderer.camera.z_far = 2000.0f;
 
+	// NOTE: Initialized before loading so the loaders can use its threads
+	renderer_init(&renderer);
+	thread_pool_t* pool = renderer_thread_pool(&renderer);
+
 	transform4d_t transform = transform4d(
 		point4d(0.0f, 0.0f, 0.0f),
 		vector4d(0.0f, 0.0f, 0.0f),
@@ -420,13 +152,13 @@ static inline void renderer_software_init() {
 	);
 
 	for (int i = 0; i < RENDER_ENTITY_COUNT; i++) {
-		entities[i] = *render_entity_load_from_obj(obj_paths[i],
-			&transform, i);
+		entities[i] = *render_entity_load_from_obj_cached(obj_paths[i],
+			&transform, i, pool);
 	}
 	renderer.entities = entities;
 
 	for (int i = 0; i < TEXTURE_COUNT; i++) {
-		textures[i] = *texture_load_from_tga(texture_paths[i]);
+		textures[i] = *texture_load_from_tga(texture_paths[i], pool);
 	}
 	renderer.textures = textures;
 
@@ -444,17 +176,12 @@ static inline void renderer_software_init() {
 		renderer.camera.fov, fb->width, fb->height);
 
 	renderer.framebuffer.image_format = IMAGE_FORMAT_ARGB;
-
-	renderer_init(&renderer);
 } // renderer_software_init
 
 static inline void renderer_software_shut() {
-	framebuffer_t* fb = &renderer.framebuffer;
-	if (fb == NULL) return;
-	if (fb->color)
-		free(fb->color);
-	if (fb->depth)
-		free(fb->depth);
+	renderer_shut(&renderer);
+
+	framebuffer_free(&renderer.framebuffer);
 } // renderer_software_shut
 
 static inline void renderer_software_loop(double dt) {
@@ -467,9 +194,153 @@ static inline void renderer_software_loop(double dt) {
 	renderer_loop(&renderer);
 } // renderer_software_loop
 
+// P R E S E N T   F U N C T I O N S ///////////////////////////////////////////
+
+// NOTE: Wall time, the process CPU time clock() measures grows with every
+//       thread the renderer keeps busy
+static inline double present_time_seconds() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1000000000.0;
+} // present_time_seconds
+
+static inline void present_image_resize(present_image_t* image,
+	int32_t width, int32_t height)
+{
+	if (image->width == width && image->height == height)
+		return;
+
+	free(image->pixels);
+	image->pixels = malloc(sizeof *image->pixels * width * height);
+	image->width = width;
+	image->height = height;
+} // present_image_resize
+
+// NOTE: Called by the render thread once a frame is rasterized. The image
+//       that is not being presented is written, with two images that is
+//       either a free one or the stale ready one.
+static inline void present_publish() {
+	framebuffer_t* fb = &renderer.framebuffer;
+
+	pthread_mutex_lock(&present.mutex);
+	int32_t index = present.presenting == 0 ? 1 : 0;
+	if (present.ready == index)
+		present.ready = -1;
+	pthread_mutex_unlock(&present.mutex);
+
+	present_image_t* image = &present.images[index];
+	present_image_resize(image, fb->width, fb->height);
+	framebuffer_detile(fb, image->pixels, image->width);
+
+	pthread_mutex_lock(&present.mutex);
+	present.ready = index;
+	pthread_cond_signal(&present.ready_cond);
+	pthread_mutex_unlock(&present.mutex);
+} // present_publish
+
+static void* present_render_loop(void* data) {
+	(void) data;
+
+	// NOTE: The print averages over a second of wall time, with the geometry
+	//       of a frame overlapping the raster of the previous one the time
+	//       between two frames is shorter than the time spent on one
+	double counter = 0.0;
+	int32_t frame_count = 0;
+	double time_previous = present_time_seconds();
+	for (;;) {
+		pthread_mutex_lock(&present.mutex);
+		int32_t quit = present.quit;
+		int32_t width = present.resize_width;
+		int32_t height = present.resize_height;
+		present.resize_width = 0;
+		present.resize_height = 0;
+		pthread_mutex_unlock(&present.mutex);
+
+		if (quit)
+			break;
+		if (width > 0 && height > 0)
+			renderer_software_on_resize(width, height);
+
+		double time_current = present_time_seconds();
+		double dt = time_current - time_previous;
+
+		counter += dt;
+		frame_count++;
+		if (counter > 1.0) {
+			printf("FPS: %f\tMS: %f\n", frame_count / counter,
+				counter * 1000 / frame_count);
+			counter = 0.0;
+			frame_count = 0;
+		}
+
+		renderer_software_loop(dt);
+
+		present_publish();
+
+		time_previous = time_current;
+	}
+	return NULL;
+} // present_render_loop
+
+static inline void present_resize(int32_t width, int32_t height) {
+	pthread_mutex_lock(&present.mutex);
+	present.resize_width = width;
+	present.resize_height = height;
+	pthread_mutex_unlock(&present.mutex);
+} // present_resize
+
+// NOTE: Blocks until the render thread published a frame and hands it to the
+//       main thread, which owns it until present_release
+static inline present_image_t* present_acquire() {
+	pthread_mutex_lock(&present.mutex);
+	while (present.ready < 0)
+		pthread_cond_wait(&present.ready_cond, &present.mutex);
+	present.presenting = present.ready;
+	present.ready = -1;
+	present_image_t* image = &present.images[present.presenting];
+	pthread_mutex_unlock(&present.mutex);
+	return image;
+} // present_acquire
+
+static inline void present_release() {
+	pthread_mutex_lock(&present.mutex);
+	present.presenting = -1;
+	pthread_mutex_unlock(&present.mutex);
+} // present_release
+
+static inline void present_init() {
+	present.ready = -1;
+	present.presenting = -1;
+	pthread_mutex_init(&present.mutex, NULL);
+	pthread_cond_init(&present.ready_cond, NULL);
+
+	if (pthread_create(&present.render_thread, NULL,
+		present_render_loop, NULL) != 0)
+	{
+		fprintf(stderr, "Could not create the render thread!\n");
+		quit();
+	}
+} // present_init
+
+static inline void present_shut() {
+	pthread_mutex_lock(&present.mutex);
+	present.quit = 1;
+	pthread_mutex_unlock(&present.mutex);
+	pthread_join(present.render_thread, NULL);
+
+	for (int32_t i = 0; i < PRESENT_IMAGE_COUNT; i++)
+		free(present.images[i].pixels);
+
+	pthread_cond_destroy(&present.ready_cond);
+	pthread_mutex_destroy(&present.mutex);
+} // present_shut
+
 // W I N D O W   F U N C T I O N S /////////////////////////////////////////////
 
 static inline void window_on_resize(int32_t width, int32_t height) {
+	ps.width = width;
+	ps.height = height;
+
 	if (ps.texture)
 		SDL_DestroyTexture(ps.texture);
 
@@ -503,15 +374,23 @@ static inline void window_shut() {
 		SDL_DestroyWindow(ps.window);
 } // window_shut
 
+// NOTE: Runs on the main thread while the render thread works on the next
+//       frame. Frames rendered before a resize do not match the texture
+//       anymore and are dropped.
 static inline void window_update() {
-	SDL_RenderClear(ps.renderer);
+	present_image_t* image = present_acquire();
 
-	framebuffer_t* fb = &renderer.framebuffer;
-	int32_t pitch = fb->width * sizeof *fb->color;
-	SDL_UpdateTexture(ps.texture, NULL, fb->color, pitch);
-	SDL_RenderCopy(ps.renderer, ps.texture, NULL, NULL);
+	if (image->width == ps.width && image->height == ps.height) {
+		SDL_RenderClear(ps.renderer);
 
-	SDL_RenderPresent(ps.renderer);
+		SDL_UpdateTexture(ps.texture, NULL, image->pixels,
+			image->width * sizeof *image->pixels);
+		SDL_RenderCopy(ps.renderer, ps.texture, NULL, NULL);
+
+		SDL_RenderPresent(ps.renderer);
+	}
+
+	present_release();
 } // window_update
 
 static inline void window_handle_window_event(SDL_Event* event) {
@@ -521,7 +400,7 @@ static inline void window_handle_window_event(SDL_Event* event) {
 				event->window.data1,
 				event->window.data2
 			);
-			renderer_software_on_resize(
+			present_resize(
 				event->window.data1,
 				event->window.data2
 			);
@@ -547,31 +426,17 @@ static inline void window_handle_event(SDL_Event* event) {
 int main() {
 	window_init();
 	renderer_software_init();
+	present_init();
 
-	double counter = 0.0f;
-	clock_t time_previous = clock();
 	while (!ps.quit) {
-		clock_t time_current = clock();
-		double dt = difftime(time_current, time_previous) /
-			CLOCKS_PER_SEC;
-
-		counter += dt;
-		if (counter > 1.0f) {
-			printf("FPS: %f\tMS: %f\n", 1 / dt, dt * 1000);
-			counter -= 1.0f;
-		}
-
 		SDL_Event event;
 		while (SDL_PollEvent(&event))
 			window_handle_event(&event);
 
-		renderer_software_loop(dt);
-
 		window_update();
-
-		time_previous = time_current;
 	}
 
+	present_shut();
 	renderer_software_shut();
 	window_shut();
 
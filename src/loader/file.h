@@ -0,0 +1,77 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../math/mathlib.h"
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+// NOTE: Read only view of a whole file, data is not zero terminated
+typedef struct file_map_t {
+	u8* data;
+	size_t size;
+} file_map_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+// Maps the file open as fd and closes fd, filepath is only used for the
+// messages. Returns 0 if the file can not be mapped.
+static inline i32 file_map_fd(file_map_t* map, i32 fd, const char* filepath) {
+	map->data = NULL;
+	map->size = 0;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		printf("Could not Load File: %s!\n", filepath);
+		close(fd);
+		return 0;
+	}
+
+	// NOTE: Empty files can not be mapped and stay at data == NULL
+	if (info.st_size > 0) {
+		void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			printf("Could not Map File: %s!\n", filepath);
+			close(fd);
+			return 0;
+		}
+		map->data = data;
+		map->size = info.st_size;
+	}
+	close(fd);
+
+	return 1;
+} // file_map_fd
+
+// Returns 0 if the file can not be opened or mapped
+static inline i32 file_map(file_map_t* map, const char* filepath) {
+	map->data = NULL;
+	map->size = 0;
+
+	i32 fd = open(filepath, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not Load File: %s!\n", filepath);
+		return 0;
+	}
+	return file_map_fd(map, fd, filepath);
+} // file_map
+
+// Modification time in nanoseconds. NOTE: st_mtim is POSIX.1-2008, with
+// -std=c99 _POSIX_C_SOURCE has to be defined as 200809L before any include.
+static inline i64 file_mtime_ns(struct stat* info) {
+	return (i64) info->st_mtim.tv_sec * 1000000000 + info->st_mtim.tv_nsec;
+} // file_mtime_ns
+
+static inline void file_unmap(file_map_t* map) {
+	if (map->data)
+		munmap(map->data, map->size);
+	map->data = NULL;
+	map->size = 0;
+} // file_unmap
+
+#endif // FILE_H
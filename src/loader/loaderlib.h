@@ -0,0 +1,9 @@
+#ifndef LOADERLIB_H
+#define LOADERLIB_H
+
+#include "file.h"
+#include "obj_loader.h"
+#include "mesh_cache.h"
+#include "tga_loader.h"
+
+#endif // LOADERLIB_H
@@ -0,0 +1,376 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../math/mathlib.h"
+#include "../renderer/renderlib.h"
+
+#include "file.h"
+#include "obj_loader.h"
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+// "MESH" in little endian, a byte swapped magic means a foreign machine
+#define MESH_CACHE_MAGIC 0x4853454D
+// Has to be increased whenever the layout of the file changes
+#define MESH_CACHE_VERSION 3
+#define MESH_CACHE_ALIGNMENT 16
+#define MESH_CACHE_EXTENSION ".mesh"
+#define MESH_CACHE_PATH_LENGTH_MAX 1024
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+typedef enum mesh_cache_array_t {
+	MESH_CACHE_ARRAY_VERTICES = 0,
+	MESH_CACHE_ARRAY_TEXCOORDS,
+	MESH_CACHE_ARRAY_NORMALS,
+	MESH_CACHE_ARRAY_INDICES,
+	MESH_CACHE_ARRAY_FACE_INDEX_COUNTS,
+	MESH_CACHE_ARRAY_CACHE_KEYS,
+	MESH_CACHE_ARRAY_CACHE_FACE_INDICES,
+	MESH_CACHE_ARRAY_TRIANGLE_INDICES,
+	MESH_CACHE_ARRAY_COUNT
+} mesh_cache_array_t;
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+// NOTE: The header is followed by the arrays in mesh_cache_array_t order,
+//       each aligned to MESH_CACHE_ALIGNMENT, see mesh_cache_layout. The
+//       checksum covers everything after the header. source_size and
+//       source_mtime_ns identify the OBJ file the cache was built from, the
+//       time has nanoseconds so edits within one second are noticed.
+typedef struct mesh_cache_header_t {
+	u32 magic;
+	u32 version;
+	u32 header_size;
+	u32 checksum;
+	u64 source_size;
+	i64 source_mtime_ns;
+	u64 file_size;
+	u32 vertex_count;
+	u32 texcoord_count;
+	u32 normal_count;
+	u32 face_count;
+	u32 index_count;
+	u32 unique_vertex_count;
+	u32 triangle_count;
+	f32 bounds_radius;
+	f32 bounds_min[4];
+	f32 bounds_max[4];
+} mesh_cache_header_t;
+
+typedef struct mesh_cache_layout_t {
+	u64 offsets[MESH_CACHE_ARRAY_COUNT];
+	u64 sizes[MESH_CACHE_ARRAY_COUNT];
+	u64 file_size;
+} mesh_cache_layout_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+static inline u64 mesh_cache_align(u64 offset) {
+	return (offset + MESH_CACHE_ALIGNMENT - 1) &
+		~((u64) MESH_CACHE_ALIGNMENT - 1);
+} // mesh_cache_align
+
+static inline void mesh_cache_layout(mesh_cache_layout_t* layout,
+	mesh_cache_header_t* header)
+{
+	layout->sizes[MESH_CACHE_ARRAY_VERTICES] =
+		(u64) header->vertex_count * sizeof(point4d_t);
+	layout->sizes[MESH_CACHE_ARRAY_TEXCOORDS] =
+		(u64) header->texcoord_count * sizeof(point2d_t);
+	layout->sizes[MESH_CACHE_ARRAY_NORMALS] =
+		(u64) header->normal_count * sizeof(vector4d_t);
+	layout->sizes[MESH_CACHE_ARRAY_INDICES] =
+		(u64) header->index_count * sizeof(index3d_t);
+	layout->sizes[MESH_CACHE_ARRAY_FACE_INDEX_COUNTS] =
+		(u64) header->face_count * sizeof(u32);
+	layout->sizes[MESH_CACHE_ARRAY_CACHE_KEYS] =
+		(u64) header->unique_vertex_count * sizeof(index3d_t);
+	layout->sizes[MESH_CACHE_ARRAY_CACHE_FACE_INDICES] =
+		(u64) header->index_count * sizeof(u32);
+	layout->sizes[MESH_CACHE_ARRAY_TRIANGLE_INDICES] =
+		(u64) header->triangle_count * 3 * sizeof(u32);
+
+	u64 offset = mesh_cache_align(sizeof(mesh_cache_header_t));
+	for (i32 i = 0; i < MESH_CACHE_ARRAY_COUNT; i++) {
+		layout->offsets[i] = offset;
+		offset = mesh_cache_align(offset + layout->sizes[i]);
+	}
+	layout->file_size = offset;
+} // mesh_cache_layout
+
+// Word wise multiply-xor hash, size has to be a multiple of 8
+static inline u32 mesh_cache_checksum(const u8* data, u64 size) {
+	u64 h = 0xCBF29CE484222325ull;
+	for (u64 i = 0; i < size; i += 8) {
+		u64 word;
+		memcpy(&word, &data[i], sizeof word);
+		h = (h ^ word) * 0x100000001B3ull;
+		h ^= h >> 29;
+	}
+	return (u32) (h ^ (h >> 32));
+} // mesh_cache_checksum
+
+static inline i32 mesh_cache_check_u32(const u32* indices, u64 count,
+	u32 limit)
+{
+	for (u64 i = 0; i < count; i++) {
+		if (indices[i] >= limit) return 0;
+	}
+	return 1;
+} // mesh_cache_check_u32
+
+// Returns 1 if every index of the mapped arrays points into the array it
+// indexes. The checksum only catches damaged files, the renderer reads
+// through these indices without any checks.
+static inline i32 mesh_cache_check_indices(const u8* data,
+	mesh_cache_header_t* header, mesh_cache_layout_t* layout)
+{
+	const index3d_t* keys = (const index3d_t *)
+		&data[layout->offsets[MESH_CACHE_ARRAY_CACHE_KEYS]];
+	for (u32 i = 0; i < header->unique_vertex_count; i++) {
+		if ((u32) keys[i].position >= header->vertex_count ||
+			(u32) keys[i].texcoord >= header->texcoord_count ||
+			(u32) keys[i].normal >= header->normal_count)
+			return 0;
+	}
+
+	const u32* face_indices = (const u32 *)
+		&data[layout->offsets[MESH_CACHE_ARRAY_CACHE_FACE_INDICES]];
+	const u32* triangle_indices = (const u32 *)
+		&data[layout->offsets[MESH_CACHE_ARRAY_TRIANGLE_INDICES]];
+	return mesh_cache_check_u32(face_indices, header->index_count,
+			header->unique_vertex_count) &&
+		mesh_cache_check_u32(triangle_indices,
+			(u64) header->triangle_count * 3, header->unique_vertex_count);
+} // mesh_cache_check_indices
+
+static inline void mesh_cache_path(char* out, const char* filepath) {
+	snprintf(out, MESH_CACHE_PATH_LENGTH_MAX, "%s%s", filepath,
+		MESH_CACHE_EXTENSION);
+} // mesh_cache_path
+
+// Writes the arrays of a loaded entity to path; the file is written under a
+// temporary name first so readers never see a partial cache
+static inline i32 mesh_cache_write(const char* path,
+	render_entity3d_t* entity, struct stat* source)
+{
+	mesh_cache_header_t header = { 0 };
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.header_size = sizeof header;
+	header.source_size = source->st_size;
+	header.source_mtime_ns = file_mtime_ns(source);
+	header.vertex_count = entity->vertex_count;
+	header.texcoord_count = entity->texcoord_count;
+	header.normal_count = entity->normal_count;
+	header.face_count = entity->face_count;
+	header.index_count = entity->index_count;
+	header.unique_vertex_count = entity->vertex_cache.count;
+	header.triangle_count = entity->triangle_count;
+
+	header.bounds_radius = entity->bounds_radius;
+	for (i32 i = 0; i < 3; i++) {
+		header.bounds_min[i] = entity->bounds_min.e[i];
+		header.bounds_max[i] = entity->bounds_max.e[i];
+	}
+
+	mesh_cache_layout_t layout;
+	mesh_cache_layout(&layout, &header);
+	header.file_size = layout.file_size;
+
+	u8* data = calloc(1, layout.file_size);
+	if (data == NULL) return 0;
+	u32* face_index_counts = (u32 *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_FACE_INDEX_COUNTS]];
+	for (u32 i = 0; i < entity->face_count; i++)
+		face_index_counts[i] = entity->faces[i].index_count;
+
+	const void* arrays[MESH_CACHE_ARRAY_COUNT] = {
+		entity->vertices,
+		entity->texcoords,
+		entity->normals,
+		entity->indices,
+		NULL,
+		entity->vertex_cache.keys,
+		entity->vertex_cache.face_indices,
+		entity->triangle_indices
+	};
+	for (i32 i = 0; i < MESH_CACHE_ARRAY_COUNT; i++) {
+		if (arrays[i] && layout.sizes[i])
+			memcpy(&data[layout.offsets[i]], arrays[i], layout.sizes[i]);
+	}
+
+	u64 payload_offset = layout.offsets[0];
+	header.checksum = mesh_cache_checksum(&data[payload_offset],
+		layout.file_size - payload_offset);
+	memcpy(data, &header, sizeof header);
+
+	char temp_path[MESH_CACHE_PATH_LENGTH_MAX + 8];
+	snprintf(temp_path, sizeof temp_path, "%s.tmp", path);
+	FILE* file = fopen(temp_path, "wb");
+	i32 written = 0;
+	if (file) {
+		written = fwrite(data, 1, layout.file_size, file) ==
+			layout.file_size;
+		written &= fclose(file) == 0;
+		if (written) written = rename(temp_path, path) == 0;
+		if (!written) remove(temp_path);
+	}
+	free(data);
+
+	if (!written)
+		printf("Could not Write Mesh Cache: %s!\n", path);
+	return written;
+} // mesh_cache_write
+
+// Maps the cache at path and points the arrays of a new entity into it.
+// Returns NULL if there is no valid cache for the source file.
+static inline render_entity3d_t* mesh_cache_load(const char* path,
+	struct stat* source)
+{
+	// NOTE: A missing cache is expected on the first run, so it is not
+	//       reported like other files that can not be opened
+	i32 fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	file_map_t file;
+	if (!file_map_fd(&file, fd, path)) return NULL;
+
+	mesh_cache_header_t header;
+	mesh_cache_layout_t layout;
+	const char* error = NULL;
+	if (file.size < sizeof header) {
+		error = "Truncated";
+	} else {
+		memcpy(&header, file.data, sizeof header);
+		mesh_cache_layout(&layout, &header);
+		if (header.magic != MESH_CACHE_MAGIC ||
+			header.version != MESH_CACHE_VERSION ||
+			header.header_size != sizeof header)
+			error = "Unknown Version";
+		else if (header.source_size != (u64) source->st_size ||
+			header.source_mtime_ns != file_mtime_ns(source))
+			error = "Stale";
+		else if (header.file_size != file.size ||
+			layout.file_size != file.size)
+			error = "Truncated";
+		else if (header.checksum != mesh_cache_checksum(
+			&file.data[layout.offsets[0]], file.size - layout.offsets[0]))
+			error = "Checksum Mismatch";
+		else if (!mesh_cache_check_indices(file.data, &header, &layout))
+			error = "Index Out of Range";
+	}
+	if (error) {
+		printf("\tIgnoring Mesh Cache %s: %s\n", path, error);
+		file_unmap(&file);
+		return NULL;
+	}
+
+	render_entity3d_t* entity = calloc(1, sizeof(render_entity3d_t));
+	u8* data = file.data;
+	entity->mapping = file.data;
+	entity->mapping_size = file.size;
+	entity->vertex_count = header.vertex_count;
+	entity->vertices = (point4d_t *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_VERTICES]];
+	entity->texcoord_count = header.texcoord_count;
+	entity->texcoords = (point2d_t *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_TEXCOORDS]];
+	entity->normal_count = header.normal_count;
+	entity->normals = (vector4d_t *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_NORMALS]];
+	entity->index_count = header.index_count;
+	entity->indices = (index3d_t *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_INDICES]];
+	entity->triangle_count = header.triangle_count;
+	entity->triangle_indices = (u32 *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_TRIANGLE_INDICES]];
+	entity->bounds_min = point4d(header.bounds_min[0], header.bounds_min[1],
+		header.bounds_min[2]);
+	entity->bounds_max = point4d(header.bounds_max[0], header.bounds_max[1],
+		header.bounds_max[2]);
+	entity->bounds_radius = header.bounds_radius;
+
+	vertex_cache3d_t* cache = &entity->vertex_cache;
+	cache->count = header.unique_vertex_count;
+	cache->keys = (index3d_t *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_CACHE_KEYS]];
+	cache->face_indices = (u32 *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_CACHE_FACE_INDICES]];
+	vertex_cache3d_alloc_frame_data(cache);
+
+	// NOTE: face3d_t holds pointers, so the faces are the only array that
+	//       is rebuilt instead of mapped
+	u32* face_index_counts = (u32 *)
+		&data[layout.offsets[MESH_CACHE_ARRAY_FACE_INDEX_COUNTS]];
+	entity->face_count = header.face_count;
+	entity->faces = malloc(sizeof *entity->faces *
+		(header.face_count ? header.face_count : 1));
+	// NOTE: Every face is checked before it is added, so a huge count can
+	//       not wrap the sum back into range. The fan triangulation has to
+	//       give exactly the mapped triangles.
+	u64 index_offset = 0;
+	u64 triangle_count = 0;
+	u32 face_count = 0;
+	for (; face_count < header.face_count; face_count++) {
+		u32 index_count = face_index_counts[face_count];
+		if (index_count > header.index_count - index_offset) break;
+
+		face3d_t* face = &entity->faces[face_count];
+		face->index_count = index_count;
+		face->indices = &entity->indices[index_offset];
+		face->cache_indices = &cache->face_indices[index_offset];
+		index_offset += index_count;
+		if (index_count >= 3) triangle_count += index_count - 2;
+	}
+	if (face_count != header.face_count ||
+		index_offset != header.index_count ||
+		triangle_count != header.triangle_count)
+	{
+		printf("\tIgnoring Mesh Cache %s: Corrupt Faces\n", path);
+		render_entity_free(entity);
+		free(entity);
+		return NULL;
+	}
+
+	return entity;
+} // mesh_cache_load
+
+// Loads the OBJ file at filepath through its mesh cache, see
+// render_entity_load_from_obj. The cache is (re)built if it is missing or
+// older than the OBJ file.
+static inline render_entity3d_t* render_entity_load_from_obj_cached(
+	const char* filepath, transform4d_t* transform, i32 material_index,
+	thread_pool_t* pool)
+{
+	struct stat source;
+	if (stat(filepath, &source) != 0) {
+		printf("Could not Load File: %s!\n", filepath);
+		return NULL;
+	}
+
+	char path[MESH_CACHE_PATH_LENGTH_MAX];
+	mesh_cache_path(path, filepath);
+	printf("Loading Mesh Cache: %s\n", path);
+	render_entity3d_t* entity = mesh_cache_load(path, &source);
+	if (entity) {
+		entity->material_index = material_index;
+		entity->transform = *transform;
+		printf("\tFace Count: %d\n", entity->face_count);
+		printf("Loading Mesh Cache %s Finished\n", path);
+		return entity;
+	}
+
+	entity = render_entity_load_from_obj(filepath, transform,
+		material_index, pool);
+	if (entity)
+		mesh_cache_write(path, entity, &source);
+	return entity;
+} // render_entity_load_from_obj_cached
+
+#endif // MESH_CACHE_H
@@ -0,0 +1,727 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../math/mathlib.h"
+#include "../renderer/renderlib.h"
+
+#include "file.h"
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+// Bytes of OBJ text parsed by one job, chunks are extended to the next line
+#define OBJ_LOADER_CHUNK_SIZE (1 << 20)
+// Digits kept by obj_decimal_t, enough to round every f32 correctly
+#define OBJ_DECIMAL_DIGIT_COUNT 800
+// Largest shift of obj_decimal_t in one step, the digits times 2^shift have
+// to fit into u64
+#define OBJ_DECIMAL_SHIFT_MAX 60
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+typedef enum obj_record_t {
+	OBJ_RECORD_NONE = 0,
+	OBJ_RECORD_VERTEX,
+	OBJ_RECORD_TEXCOORD,
+	OBJ_RECORD_NORMAL,
+	OBJ_RECORD_FACE
+} obj_record_t;
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+// NOTE: The first pass counts the records of every chunk, the second pass
+//       parses them straight into the arrays of the entity at the offsets
+//       given by the counts of the preceding chunks
+typedef struct obj_chunk_t {
+	const u8* begin;
+	const u8* end;
+	u32 vertex_count;
+	u32 vertex_offset;
+	u32 texcoord_count;
+	u32 texcoord_offset;
+	u32 normal_count;
+	u32 normal_offset;
+	u32 face_count;
+	u32 face_offset;
+	u32 index_count;
+	u32 index_offset;
+	u32 error_count;
+} obj_chunk_t;
+
+// NOTE: The number 0.d[0]d[1]...d[count - 1] * 10^point with one digit per
+//       byte and no trailing zeros, used by the slow path of obj_parse_f32.
+//       Nonzero digits beyond OBJ_DECIMAL_DIGIT_COUNT are dropped and only
+//       set truncated, which decides ties.
+typedef struct obj_decimal_t {
+	u8 digits[OBJ_DECIMAL_DIGIT_COUNT];
+	i32 count;
+	i32 point;
+	i32 truncated;
+} obj_decimal_t;
+
+typedef struct obj_loader_t {
+	render_entity3d_t* entity;
+	i32 chunk_count;
+	obj_chunk_t* chunks;
+} obj_loader_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+static const f64 obj_pow10[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Binary shifts that move the decimal point of obj_decimal_t by at most
+// the index in digits without passing a power of ten
+static const i32 obj_decimal_shifts[9] = { 1, 3, 6, 9, 13, 16, 19, 23, 26 };
+
+static inline i32 obj_is_space(u8 c) {
+	return c == ' ' || c == '\t' || c == '\r';
+} // obj_is_space
+
+static inline i32 obj_is_digit(u8 c) {
+	return (u8) (c - '0') < 10;
+} // obj_is_digit
+
+static inline const u8* obj_line_end(const u8* p, const u8* end) {
+	const u8* line_end = memchr(p, '\n', end - p);
+	return line_end ? line_end : end;
+} // obj_line_end
+
+// NOTE: Same records as the fgetc based loader recognized, anything else
+//       is skipped up to the end of the line
+static inline obj_record_t obj_record_type(const u8* p, const u8* line_end) {
+	if (line_end - p < 2) return OBJ_RECORD_NONE;
+	if (p[0] == 'v') {
+		if (p[1] == ' ') return OBJ_RECORD_VERTEX;
+		if (p[1] == 't') return OBJ_RECORD_TEXCOORD;
+		if (p[1] == 'n') return OBJ_RECORD_NORMAL;
+	} else if (p[0] == 'f' && p[1] == ' ') {
+		return OBJ_RECORD_FACE;
+	}
+	return OBJ_RECORD_NONE;
+} // obj_record_type
+
+static inline u32 obj_count_tokens(const u8* p, const u8* line_end) {
+	u32 count = 0;
+	i32 in_token = 0;
+	for (; p < line_end; p++) {
+		i32 space = obj_is_space(*p);
+		if (!space && !in_token) count++;
+		in_token = !space;
+	}
+	return count;
+} // obj_count_tokens
+
+static inline void obj_decimal_trim(obj_decimal_t* d) {
+	while (d->count > 0 && d->digits[d->count - 1] == 0) d->count--;
+	if (d->count == 0) d->point = 0;
+} // obj_decimal_trim
+
+static inline void obj_decimal_add_digit(obj_decimal_t* d, u8 digit,
+	i32 fraction)
+{
+	if (d->count == 0 && digit == 0) {
+		if (fraction) d->point--;
+		return;
+	}
+	if (!fraction) d->point++;
+	if (d->count < OBJ_DECIMAL_DIGIT_COUNT) d->digits[d->count++] = digit;
+	else if (digit) d->truncated = 1;
+} // obj_decimal_add_digit
+
+// Multiplies by 2^shift, shift is at most OBJ_DECIMAL_SHIFT_MAX
+static inline void obj_decimal_shift_left(obj_decimal_t* d, i32 shift) {
+	// NOTE: The product is built from the last digit, so its digits come
+	//       out in reverse order
+	u8 reversed[OBJ_DECIMAL_DIGIT_COUNT + 20];
+	i32 count = 0;
+	u64 n = 0;
+	for (i32 r = d->count - 1; r >= 0; r--) {
+		n += (u64) d->digits[r] << shift;
+		u64 quotient = n / 10;
+		reversed[count++] = (u8) (n - quotient * 10);
+		n = quotient;
+	}
+	for (; n > 0; n /= 10)
+		reversed[count++] = (u8) (n % 10);
+
+	d->point += count - d->count;
+	d->count = 0;
+	for (i32 r = count - 1; r >= 0; r--) {
+		if (d->count < OBJ_DECIMAL_DIGIT_COUNT)
+			d->digits[d->count++] = reversed[r];
+		else if (reversed[r])
+			d->truncated = 1;
+	}
+	obj_decimal_trim(d);
+} // obj_decimal_shift_left
+
+// Divides by 2^shift, shift is at most OBJ_DECIMAL_SHIFT_MAX
+static inline void obj_decimal_shift_right(obj_decimal_t* d, i32 shift) {
+	// NOTE: Long division in place, the quotient never has more leading
+	//       digits than the dividend
+	i32 r = 0;
+	i32 w = 0;
+	u64 n = 0;
+	for (; (n >> shift) == 0; r++) {
+		if (r >= d->count) {
+			if (n == 0) {
+				d->count = 0;
+				d->point = 0;
+				return;
+			}
+			for (; (n >> shift) == 0; r++) n *= 10;
+			break;
+		}
+		n = n * 10 + d->digits[r];
+	}
+	d->point -= r - 1;
+
+	u64 mask = (1ull << shift) - 1;
+	for (; r < d->count; r++) {
+		u8 digit = d->digits[r];
+		d->digits[w++] = (u8) (n >> shift);
+		n = (n & mask) * 10 + digit;
+	}
+	for (; n > 0; n = (n & mask) * 10) {
+		u8 digit = (u8) (n >> shift);
+		if (w < OBJ_DECIMAL_DIGIT_COUNT) d->digits[w++] = digit;
+		else if (digit) d->truncated = 1;
+	}
+	d->count = w;
+	obj_decimal_trim(d);
+} // obj_decimal_shift_right
+
+// Multiplies by 2^shift, a negative shift divides
+static inline void obj_decimal_shift(obj_decimal_t* d, i32 shift) {
+	while (shift > 0) {
+		i32 step = min(shift, OBJ_DECIMAL_SHIFT_MAX);
+		obj_decimal_shift_left(d, step);
+		shift -= step;
+	}
+	while (shift < 0) {
+		i32 step = min(-shift, OBJ_DECIMAL_SHIFT_MAX);
+		obj_decimal_shift_right(d, step);
+		shift += step;
+	}
+} // obj_decimal_shift
+
+// Integer part rounded half to even, the value has to be below 10^19
+static inline u64 obj_decimal_round(obj_decimal_t* d) {
+	u64 n = 0;
+	i32 i = 0;
+	for (; i < d->point && i < d->count; i++) n = n * 10 + d->digits[i];
+	for (; i < d->point; i++) n *= 10;
+
+	i32 up = 0;
+	if (d->point >= 0 && d->point < d->count) {
+		if (d->digits[d->point] == 5 && d->point + 1 == d->count) {
+			up = d->truncated || (n & 1);
+		} else {
+			up = d->digits[d->point] >= 5;
+		}
+	}
+	return n + up;
+} // obj_decimal_round
+
+// Bits of the f32 closest to the magnitude of d. The value is scaled by
+// powers of two into [0.5, 1), then the 24 bits of the significand are
+// rounded from the value times 2^24.
+static inline u32 obj_decimal_to_f32_bits(obj_decimal_t* d) {
+	const i32 bias = -127;
+	const u32 exponent_inf = 0xFF;
+	const u32 significand_bits = 23;
+	if (d->count == 0 || d->point < -50) return 0;
+	if (d->point > 40) return exponent_inf << significand_bits;
+
+	i32 exponent = 0;
+	while (d->point > 0) {
+		i32 shift = (d->point >= 9) ? 27 : obj_decimal_shifts[d->point];
+		obj_decimal_shift(d, -shift);
+		exponent += shift;
+	}
+	while (d->point < 0 || (d->point == 0 && d->digits[0] < 5)) {
+		i32 shift = (-d->point >= 9) ? 27 : obj_decimal_shifts[-d->point];
+		obj_decimal_shift(d, shift);
+		exponent -= shift;
+	}
+	// NOTE: The value is in [0.5, 1) now, so it is 2^(exponent - 1) times a
+	//       value in [1, 2)
+	exponent--;
+
+	// NOTE: Subnormals keep the smallest exponent and lose significand bits
+	if (exponent < bias + 1) {
+		obj_decimal_shift(d, exponent - (bias + 1));
+		exponent = bias + 1;
+	}
+	if (exponent - bias >= (i32) exponent_inf)
+		return exponent_inf << significand_bits;
+
+	obj_decimal_shift(d, significand_bits + 1);
+	u64 significand = obj_decimal_round(d);
+	if (significand == (2ull << significand_bits)) {
+		significand >>= 1;
+		exponent++;
+		if (exponent - bias >= (i32) exponent_inf)
+			return exponent_inf << significand_bits;
+	}
+	if (!(significand & (1ull << significand_bits))) exponent = bias;
+
+	return (u32) (significand & ((1u << significand_bits) - 1)) |
+		(u32) (exponent - bias) << significand_bits;
+} // obj_decimal_to_f32_bits
+
+// Length of word at c compared without case, 0 if it is not there
+static inline i32 obj_match_word(const u8* c, const u8* end,
+	const char* word)
+{
+	i32 length = 0;
+	for (; word[length]; length++) {
+		if (c + length >= end || (c[length] | 0x20) != word[length])
+			return 0;
+	}
+	return length;
+} // obj_match_word
+
+// Parses inf, infinity and nan with an optional (chars) suffix
+static inline i32 obj_parse_f32_special(const u8** cursor, const u8* c,
+	const u8* end, i32 negative, f32* out)
+{
+	union { u32 i; f32 f; } bits;
+	i32 length = obj_match_word(c, end, "infinity");
+	if (length == 0) length = obj_match_word(c, end, "inf");
+	if (length) {
+		bits.i = 0x7F800000;
+	} else {
+		length = obj_match_word(c, end, "nan");
+		if (length == 0) return 0;
+		bits.i = 0x7FC00000;
+
+		const u8* p = c + length;
+		if (p < end && *p == '(') {
+			p++;
+			while (p < end && (obj_is_digit(*p) || *p == '_' ||
+				(u8) ((*p | 0x20) - 'a') < 26))
+				p++;
+			if (p < end && *p == ')') length = p + 1 - c;
+		}
+	}
+	if (negative) bits.i |= 0x80000000;
+	*out = bits.f;
+	*cursor = c + length;
+	return 1;
+} // obj_parse_f32_special
+
+// Correctly rounded conversion of any number through obj_decimal_t, for
+// the numbers the fast path of obj_parse_f32 can not convert exactly.
+// Accepts the same syntax as strtof in the C locale except hexadecimal.
+static inline i32 obj_parse_f32_slow(const u8** cursor, const u8* start,
+	const u8* end, f32* out)
+{
+	const u8* c = start;
+	i32 negative = 0;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = (*c == '-');
+		c++;
+	}
+	const u8* digits = c;
+
+	obj_decimal_t d;
+	d.count = 0;
+	d.point = 0;
+	d.truncated = 0;
+	i32 digits_found = 0;
+	for (; c < end && obj_is_digit(*c); c++) {
+		digits_found = 1;
+		obj_decimal_add_digit(&d, *c - '0', 0);
+	}
+	if (c < end && *c == '.') {
+		for (c++; c < end && obj_is_digit(*c); c++) {
+			digits_found = 1;
+			obj_decimal_add_digit(&d, *c - '0', 1);
+		}
+	}
+	if (!digits_found)
+		return obj_parse_f32_special(cursor, digits, end, negative, out);
+
+	if (c < end && (*c == 'e' || *c == 'E')) {
+		const u8* e = c + 1;
+		i32 exponent_negative = 0;
+		if (e < end && (*e == '-' || *e == '+')) {
+			exponent_negative = (*e == '-');
+			e++;
+		}
+		if (e < end && obj_is_digit(*e)) {
+			i32 value = 0;
+			for (; e < end && obj_is_digit(*e); e++) {
+				if (value < 100000) value = value * 10 + (*e - '0');
+			}
+			d.point += exponent_negative ? -value : value;
+			c = e;
+		}
+	}
+	obj_decimal_trim(&d);
+
+	union { u32 i; f32 f; } bits = { obj_decimal_to_f32_bits(&d) };
+	if (negative) bits.i |= 0x80000000;
+	*out = bits.f;
+	*cursor = c;
+	return 1;
+} // obj_parse_f32_slow
+
+// Locale independent, correctly rounded float parser. Up to 19 significant
+// digits with a small exponent are converted exactly through f64, the rest
+// goes through obj_parse_f32_slow. Returns 0 if there is no number.
+static inline i32 obj_parse_f32(const u8** cursor, const u8* end, f32* out)
+{
+	const u8* c = *cursor;
+	while (c < end && obj_is_space(*c)) c++;
+	const u8* start = c;
+
+	i32 negative = 0;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = (*c == '-');
+		c++;
+	}
+
+	u64 mantissa = 0;
+	i32 digit_count = 0;
+	i32 digits_found = 0;
+	i32 exponent = 0;
+	i32 exact = 1;
+	for (; c < end && obj_is_digit(*c); c++) {
+		digits_found = 1;
+		if (digit_count < 19) {
+			mantissa = mantissa * 10 + (*c - '0');
+			if (mantissa) digit_count++;
+		} else {
+			exponent++;
+			if (*c != '0') exact = 0;
+		}
+	}
+	if (c < end && *c == '.') {
+		for (c++; c < end && obj_is_digit(*c); c++) {
+			digits_found = 1;
+			if (digit_count < 19) {
+				mantissa = mantissa * 10 + (*c - '0');
+				if (mantissa) digit_count++;
+				exponent--;
+			} else if (*c != '0') {
+				exact = 0;
+			}
+		}
+	}
+	if (!digits_found) return obj_parse_f32_slow(cursor, start, end, out);
+
+	if (c < end && (*c == 'e' || *c == 'E')) {
+		const u8* e = c + 1;
+		i32 exponent_negative = 0;
+		if (e < end && (*e == '-' || *e == '+')) {
+			exponent_negative = (*e == '-');
+			e++;
+		}
+		if (e < end && obj_is_digit(*e)) {
+			i32 value = 0;
+			for (; e < end && obj_is_digit(*e); e++) {
+				if (value < 100000) value = value * 10 + (*e - '0');
+			}
+			exponent += exponent_negative ? -value : value;
+			c = e;
+		}
+	}
+
+	if (mantissa == 0) {
+		*out = negative ? -0.0f : 0.0f;
+		*cursor = c;
+		return 1;
+	}
+
+	if (exact && exponent >= -22 && exponent <= 22 &&
+		mantissa < (1ull << 53))
+	{
+		// NOTE: Both operands are exact, so the result is correctly
+		//       rounded to f64. Rounding that to f32 only differs from
+		//       rounding the decimal directly if it lies exactly halfway
+		//       between two floats.
+		f64 value = (f64) mantissa;
+		if (exponent < 0) value /= obj_pow10[-exponent];
+		else value *= obj_pow10[exponent];
+		union { f64 f; u64 i; } bits = { value };
+		if ((bits.i & 0x1FFFFFFF) != 0x10000000 &&
+			value >= FLT_MIN && value <= FLT_MAX)
+		{
+			*out = negative ? -(f32) value : (f32) value;
+			*cursor = c;
+			return 1;
+		}
+	}
+
+	return obj_parse_f32_slow(cursor, start, end, out);
+} // obj_parse_f32
+
+static inline i32 obj_parse_i32(const u8** cursor, const u8* end, i32* out) {
+	const u8* c = *cursor;
+	i32 negative = 0;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = (*c == '-');
+		c++;
+	}
+	if (c >= end || !obj_is_digit(*c)) return 0;
+
+	i32 value = 0;
+	for (; c < end && obj_is_digit(*c); c++)
+		value = value * 10 + (*c - '0');
+	*out = negative ? -value : value;
+	*cursor = c;
+	return 1;
+} // obj_parse_i32
+
+// Parses position/texcoord/normal, returns 0 if a part is missing
+static inline i32 obj_parse_index(const u8** cursor, const u8* end,
+	index3d_t* out)
+{
+	const u8* c = *cursor;
+	index3d_t index = { 0 };
+	i32 parsed = obj_parse_i32(&c, end, &index.position);
+	if (c < end && *c == '/') {
+		c++;
+		parsed += obj_parse_i32(&c, end, &index.texcoord);
+		if (c < end && *c == '/') {
+			c++;
+			parsed += obj_parse_i32(&c, end, &index.normal);
+		}
+	}
+
+	// NOTE: Skip whatever is left of the token to stay in step with
+	//       obj_count_tokens
+	i32 trailing = 0;
+	for (; c < end && !obj_is_space(*c); c++)
+		trailing = 1;
+
+	// NOTE: In OBJ indices start with 1;
+	//       In renderer indices start with 0
+	index.position--;
+	index.texcoord--;
+	index.normal--;
+	*out = index;
+	*cursor = c;
+	return parsed == 3 && !trailing;
+} // obj_parse_index
+
+static inline void obj_loader_count_job(void* data, i32 index,
+	i32 thread_index)
+{
+	(void) thread_index;
+	obj_loader_t* loader = data;
+	obj_chunk_t* chunk = &loader->chunks[index];
+
+	const u8* p = chunk->begin;
+	while (p < chunk->end) {
+		const u8* line_end = obj_line_end(p, chunk->end);
+		switch (obj_record_type(p, line_end)) {
+			case OBJ_RECORD_VERTEX:
+				chunk->vertex_count++;
+				break;
+			case OBJ_RECORD_TEXCOORD:
+				chunk->texcoord_count++;
+				break;
+			case OBJ_RECORD_NORMAL:
+				chunk->normal_count++;
+				break;
+			case OBJ_RECORD_FACE: {
+				u32 count = obj_count_tokens(p + 2, line_end);
+				if (count) {
+					chunk->face_count++;
+					chunk->index_count += count;
+				}
+			} break;
+			case OBJ_RECORD_NONE:
+			default:
+				break;
+		}
+		p = (line_end < chunk->end) ? line_end + 1 : chunk->end;
+	}
+} // obj_loader_count_job
+
+static inline void obj_loader_parse_job(void* data, i32 index,
+	i32 thread_index)
+{
+	(void) thread_index;
+	obj_loader_t* loader = data;
+	obj_chunk_t* chunk = &loader->chunks[index];
+	render_entity3d_t* entity = loader->entity;
+
+	point4d_t* vertex = &entity->vertices[chunk->vertex_offset];
+	point2d_t* texcoord = &entity->texcoords[chunk->texcoord_offset];
+	vector4d_t* normal = &entity->normals[chunk->normal_offset];
+	face3d_t* face = &entity->faces[chunk->face_offset];
+	index3d_t* indices = &entity->indices[chunk->index_offset];
+
+	const u8* p = chunk->begin;
+	while (p < chunk->end) {
+		const u8* line_end = obj_line_end(p, chunk->end);
+		const u8* c = p + 2;
+		switch (obj_record_type(p, line_end)) {
+			case OBJ_RECORD_VERTEX: {
+				f32 x = 0.0f, y = 0.0f, z = 0.0f;
+				i32 parsed = obj_parse_f32(&c, line_end, &x);
+				parsed += obj_parse_f32(&c, line_end, &y);
+				parsed += obj_parse_f32(&c, line_end, &z);
+				if (parsed != 3) chunk->error_count++;
+				*vertex++ = point4d(x, y, z);
+			} break;
+			case OBJ_RECORD_TEXCOORD: {
+				f32 u = 0.0f, v = 0.0f;
+				i32 parsed = obj_parse_f32(&c, line_end, &u);
+				parsed += obj_parse_f32(&c, line_end, &v);
+				if (parsed != 2) chunk->error_count++;
+				*texcoord++ = point2d(u, v);
+			} break;
+			case OBJ_RECORD_NORMAL: {
+				f32 x = 0.0f, y = 0.0f, z = 0.0f;
+				i32 parsed = obj_parse_f32(&c, line_end, &x);
+				parsed += obj_parse_f32(&c, line_end, &y);
+				parsed += obj_parse_f32(&c, line_end, &z);
+				if (parsed != 3) chunk->error_count++;
+				*normal++ = vector4d(x, y, z);
+			} break;
+			case OBJ_RECORD_FACE: {
+				u32 count = 0;
+				for (;;) {
+					while (c < line_end && obj_is_space(*c)) c++;
+					if (c >= line_end) break;
+					if (!obj_parse_index(&c, line_end, &indices[count]))
+						chunk->error_count++;
+					count++;
+				}
+				if (count) {
+					face->index_count = count;
+					face->indices = indices;
+					face->cache_indices = NULL;
+					face++;
+					indices += count;
+				}
+			} break;
+			case OBJ_RECORD_NONE:
+			default:
+				break;
+		}
+		p = (line_end < chunk->end) ? line_end + 1 : chunk->end;
+	}
+} // obj_loader_parse_job
+
+// Loads the file through a memory map and parses line aligned chunks of it
+// in parallel on pool, which may be NULL to parse on the calling thread.
+// Returns NULL if the file can not be read.
+static inline render_entity3d_t* render_entity_load_from_obj(
+	const char* filepath, transform4d_t* transform, i32 material_index,
+	thread_pool_t* pool)
+{
+	printf("Loading OBJ File: %s\n", filepath);
+
+	file_map_t file;
+	if (!file_map(&file, filepath)) return NULL;
+
+	obj_loader_t loader = { 0 };
+	loader.chunks = calloc(file.size / OBJ_LOADER_CHUNK_SIZE + 1,
+		sizeof *loader.chunks);
+	const u8* p = file.data;
+	const u8* end = file.data + file.size;
+	while (p < end) {
+		const u8* chunk_end = end;
+		if ((size_t) (end - p) > OBJ_LOADER_CHUNK_SIZE) {
+			chunk_end = obj_line_end(p + OBJ_LOADER_CHUNK_SIZE, end);
+			if (chunk_end < end) chunk_end++;
+		}
+		obj_chunk_t* chunk = &loader.chunks[loader.chunk_count++];
+		chunk->begin = p;
+		chunk->end = chunk_end;
+		p = chunk_end;
+	}
+
+	thread_pool_run(pool, loader.chunk_count, obj_loader_count_job, &loader);
+
+	render_entity3d_t* entity = calloc(1, sizeof(render_entity3d_t));
+	loader.entity = entity;
+	for (i32 i = 0; i < loader.chunk_count; i++) {
+		obj_chunk_t* chunk = &loader.chunks[i];
+		chunk->vertex_offset = entity->vertex_count;
+		chunk->texcoord_offset = entity->texcoord_count;
+		chunk->normal_offset = entity->normal_count;
+		chunk->face_offset = entity->face_count;
+		chunk->index_offset = entity->index_count;
+		entity->vertex_count += chunk->vertex_count;
+		entity->texcoord_count += chunk->texcoord_count;
+		entity->normal_count += chunk->normal_count;
+		entity->face_count += chunk->face_count;
+		entity->index_count += chunk->index_count;
+	}
+	entity->vertices = malloc(sizeof *entity->vertices *
+		entity->vertex_count);
+	entity->texcoords = malloc(sizeof *entity->texcoords *
+		entity->texcoord_count);
+	entity->normals = malloc(sizeof *entity->normals *
+		entity->normal_count);
+	entity->faces = malloc(sizeof *entity->faces * entity->face_count);
+	entity->indices = malloc(sizeof *entity->indices *
+		(entity->index_count ? entity->index_count : 1));
+
+	thread_pool_run(pool, loader.chunk_count, obj_loader_parse_job, &loader);
+
+	u32 error_count = 0;
+	for (i32 i = 0; i < loader.chunk_count; i++)
+		error_count += loader.chunks[i].error_count;
+	if (error_count)
+		fprintf(stderr, "Error loading file!\n\tMalformed Records: %u\n",
+			error_count);
+
+	free(loader.chunks);
+	file_unmap(&file);
+
+	render_entity3d_compute_bounds(entity);
+
+	printf("\tVertex Count: %d\n", entity->vertex_count);
+	printf("\tTexcoord Count: %d\n", entity->texcoord_count);
+	printf("\tNormal Count: %d\n", entity->normal_count);
+	printf("\tFace Count: %d\n", entity->face_count);
+
+	vertex_cache3d_build(&entity->vertex_cache, entity->faces,
+		entity->face_count);
+	printf("\tUnique Vertex Count: %d\n", entity->vertex_cache.count);
+
+	render_entity3d_triangulate(entity);
+	printf("\tTriangle Count: %d\n", entity->triangle_count);
+
+	entity->material_index = material_index;
+	entity->transform = *transform;
+
+	printf("Loading OBJ File %s Finished\n", filepath);
+	return entity;
+} // render_entity_load_from_obj
+
+// NOTE: The arrays of an entity loaded from a mesh cache point into the
+//       mapping, only the faces and the per frame vertex data are owned
+static inline void render_entity_free(render_entity3d_t* entity) {
+	free(entity->faces);
+	if (entity->mapping) {
+		vertex_cache3d_free_frame_data(&entity->vertex_cache);
+		file_map_t map = { entity->mapping, entity->mapping_size };
+		file_unmap(&map);
+	} else {
+		free(entity->vertices);
+		free(entity->texcoords);
+		free(entity->normals);
+		free(entity->indices);
+		vertex_cache3d_free(&entity->vertex_cache);
+		free(entity->triangle_indices);
+	}
+	memset(entity, 0, sizeof *entity);
+} // render_entity_free
+
+#endif // OBJ_LOADER_H
@@ -0,0 +1,410 @@
+#ifndef TGA_LOADER_H
+#define TGA_LOADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../math/mathlib.h"
+#include "../renderer/renderlib.h"
+
+#include "file.h"
+
+#if defined(__SSE2__) && !defined(RENDERER_NO_SIMD)
+	#define TGA_LOADER_SSE2
+	#include <emmintrin.h>
+#endif
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+#define TGA_VERTICAL_FLIP_BIT 0x20
+#define TGA_HORIZONTAL_FLIP_BIT 0x10
+#define TGA_RLE_PACKET_BIT 0x80
+#define TGA_RLE_COUNT_MASK 0x7F
+
+// Texels converted by one job of an uncompressed image, smaller images are
+// converted on the calling thread
+#define TGA_LOADER_JOB_TEXEL_COUNT (1 << 16)
+// Largest image that is loaded. The renderer indexes texels with i32, the
+// limit leaves room for the mip chain, which adds less than half again.
+#define TGA_TEXEL_COUNT_MAX 0x3FFFFFFF
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+typedef enum tga_image_type_t {
+	TGA_IMAGE_TYPE_NONE = 0,
+	TGA_IMAGE_TYPE_COLOR_MAPPED = 1,
+	TGA_IMAGE_TYPE_TRUE_COLOR = 2,
+	TGA_IMAGE_TYPE_GRAYSCALE = 3,
+	TGA_IMAGE_TYPE_RLE_COLOR_MAPPED = 9,
+	TGA_IMAGE_TYPE_RLE_TRUE_COLOR = 10,
+	TGA_IMAGE_TYPE_RLE_GRAYSCALE = 11
+} tga_image_type_t;
+
+// Layout of one pixel in the file
+typedef enum tga_format_t {
+	TGA_FORMAT_NONE = 0,
+	TGA_FORMAT_GRAY,
+	TGA_FORMAT_GRAY_ALPHA,
+	TGA_FORMAT_BGR555,
+	TGA_FORMAT_BGR,
+	TGA_FORMAT_BGRA,
+	TGA_FORMAT_INDEX8,
+	TGA_FORMAT_INDEX16
+} tga_format_t;
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+#pragma pack(push, 1)
+typedef struct tga_header_t {
+	u8 id_length;
+	u8 color_map_type;
+	u8 image_type;
+	u16 color_map_start;
+	u16 color_map_length;
+	u8 color_map_depth;
+	u16 x_origin;
+	u16 y_origin;
+	u16 width;
+	u16 height;
+	u8 bits_per_pixel;
+	u8 image_descriptor;
+} tga_header_t;
+#pragma pack(pop)
+
+// NOTE: Rows are written in texture order while decoding, file row y ends up
+//       in texture row (vertical_flip ? height - 1 - y : y)
+typedef struct tga_loader_t {
+	texture_t* tex;
+	const u8* pixels;
+	const u8* end;
+	tga_format_t format;
+	i32 bytes_per_pixel;
+	u32* palette;
+	u32 palette_start;
+	u32 palette_count;
+	i32 vertical_flip;
+	i32 horizontal_flip;
+	i32 row_count;
+	i32 rows_per_job;
+} tga_loader_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+static inline tga_format_t tga_format(i32 image_type, i32 bits_per_pixel) {
+	switch (image_type) {
+	case TGA_IMAGE_TYPE_COLOR_MAPPED:
+	case TGA_IMAGE_TYPE_RLE_COLOR_MAPPED:
+		if (bits_per_pixel == 8) return TGA_FORMAT_INDEX8;
+		if (bits_per_pixel == 16) return TGA_FORMAT_INDEX16;
+		break;
+	case TGA_IMAGE_TYPE_TRUE_COLOR:
+	case TGA_IMAGE_TYPE_RLE_TRUE_COLOR:
+		if (bits_per_pixel == 15 || bits_per_pixel == 16)
+			return TGA_FORMAT_BGR555;
+		if (bits_per_pixel == 24) return TGA_FORMAT_BGR;
+		if (bits_per_pixel == 32) return TGA_FORMAT_BGRA;
+		break;
+	case TGA_IMAGE_TYPE_GRAYSCALE:
+	case TGA_IMAGE_TYPE_RLE_GRAYSCALE:
+		if (bits_per_pixel == 8) return TGA_FORMAT_GRAY;
+		if (bits_per_pixel == 16) return TGA_FORMAT_GRAY_ALPHA;
+		break;
+	}
+	return TGA_FORMAT_NONE;
+} // tga_format
+
+static inline u32 tga_palette_texel(tga_loader_t* loader, u32 index) {
+	index -= loader->palette_start;
+	return (index < loader->palette_count) ? loader->palette[index] : 0;
+} // tga_palette_texel
+
+// Converts count pixels from the file to packed texels
+static inline void tga_convert_span(u32* dst, const u8* src, i32 count,
+	tga_format_t format, tga_loader_t* loader)
+{
+	i32 i = 0;
+	switch (format) {
+	case TGA_FORMAT_GRAY:
+#ifdef TGA_LOADER_SSE2
+		{
+			__m128i alpha = _mm_set1_epi32((i32) 0xFF000000);
+			for (; i + 16 <= count; i += 16) {
+				__m128i g = _mm_loadu_si128((const __m128i *) &src[i]);
+				__m128i lo = _mm_unpacklo_epi8(g, g);
+				__m128i hi = _mm_unpackhi_epi8(g, g);
+				_mm_storeu_si128((__m128i *) &dst[i], _mm_or_si128(alpha,
+					_mm_unpacklo_epi16(lo, lo)));
+				_mm_storeu_si128((__m128i *) &dst[i + 4], _mm_or_si128(alpha,
+					_mm_unpackhi_epi16(lo, lo)));
+				_mm_storeu_si128((__m128i *) &dst[i + 8], _mm_or_si128(alpha,
+					_mm_unpacklo_epi16(hi, hi)));
+				_mm_storeu_si128((__m128i *) &dst[i + 12], _mm_or_si128(alpha,
+					_mm_unpackhi_epi16(hi, hi)));
+			}
+		}
+#endif
+		for (; i < count; i++)
+			dst[i] = texel_argb(src[i], src[i], src[i], 0xFF);
+		break;
+	case TGA_FORMAT_GRAY_ALPHA:
+		for (; i < count; i++) {
+			const u8* p = &src[i * 2];
+			dst[i] = texel_argb(p[0], p[0], p[0], p[1]);
+		}
+		break;
+	case TGA_FORMAT_BGR555:
+		for (; i < count; i++) {
+			u32 c = src[i * 2] | (u32) src[i * 2 + 1] << 8;
+			u32 r = (c >> 10) & 0x1F;
+			u32 g = (c >> 5) & 0x1F;
+			u32 b = c & 0x1F;
+			dst[i] = texel_argb(r << 3 | r >> 2, g << 3 | g >> 2,
+				b << 3 | b >> 2, 0xFF);
+		}
+		break;
+	case TGA_FORMAT_BGR:
+#ifdef TGA_LOADER_SSE2
+		{
+			// NOTE: SSE2 has no byte shuffle, four BGR pixels are moved into
+			//       their lanes with whole register shifts
+			__m128i mask = _mm_set1_epi32(0x00FFFFFF);
+			__m128i alpha = _mm_set1_epi32((i32) 0xFF000000);
+			for (; i + 6 <= count; i += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i *) &src[i * 3]);
+				__m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+				__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6),
+					_mm_srli_si128(v, 9));
+				__m128i p = _mm_unpacklo_epi64(p01, p23);
+				_mm_storeu_si128((__m128i *) &dst[i],
+					_mm_or_si128(_mm_and_si128(p, mask), alpha));
+			}
+		}
+#endif
+		for (; i < count; i++) {
+			const u8* p = &src[i * 3];
+			dst[i] = texel_argb(p[2], p[1], p[0], 0xFF);
+		}
+		break;
+	case TGA_FORMAT_BGRA:
+		// NOTE: TGA stores the channels as BGRA, which is the byte order of
+		//       the packed texels on little endian machines
+		memcpy(dst, src, sizeof *dst * count);
+		break;
+	case TGA_FORMAT_INDEX8:
+		for (; i < count; i++)
+			dst[i] = tga_palette_texel(loader, src[i]);
+		break;
+	case TGA_FORMAT_INDEX16:
+		for (; i < count; i++)
+			dst[i] = tga_palette_texel(loader,
+				src[i * 2] | (u32) src[i * 2 + 1] << 8);
+		break;
+	case TGA_FORMAT_NONE:
+		break;
+	}
+} // tga_convert_span
+
+static inline u32* tga_loader_row(tga_loader_t* loader, i32 y) {
+	texture_t* tex = loader->tex;
+	if (loader->vertical_flip) y = tex->height - 1 - y;
+	return &tex->data[(size_t) y * tex->width];
+} // tga_loader_row
+
+static inline void tga_loader_finish_row(tga_loader_t* loader, u32* row) {
+	if (!loader->horizontal_flip) return;
+	for (i32 l = 0, r = loader->tex->width - 1; l < r; l++, r--)
+		texture_swap_texels(&row[l], &row[r]);
+} // tga_loader_finish_row
+
+static inline void tga_loader_convert_job(void* data, i32 index,
+	i32 thread_index)
+{
+	(void) thread_index;
+	tga_loader_t* loader = data;
+	texture_t* tex = loader->tex;
+	i32 y_begin = index * loader->rows_per_job;
+	i32 y_end = min(y_begin + loader->rows_per_job, loader->row_count);
+	size_t row_size = (size_t) tex->width * loader->bytes_per_pixel;
+	for (i32 y = y_begin; y < y_end; y++) {
+		u32* row = tga_loader_row(loader, y);
+		tga_convert_span(row, &loader->pixels[y * row_size], tex->width,
+			loader->format, loader);
+		tga_loader_finish_row(loader, row);
+	}
+} // tga_loader_convert_job
+
+// Decodes the run length encoded packets in one pass; packets may cross row
+// boundaries. Returns 0 if the data ends early, the rest stays black.
+static inline i32 tga_loader_decode_rle(tga_loader_t* loader) {
+	texture_t* tex = loader->tex;
+	const u8* p = loader->pixels;
+	i32 bytes_per_pixel = loader->bytes_per_pixel;
+	i32 x = 0;
+	i32 y = 0;
+	u32* row = tga_loader_row(loader, 0);
+	while (y < tex->height) {
+		if (p >= loader->end) {
+			for (; y < tex->height; y++, x = 0) {
+				row = tga_loader_row(loader, y);
+				memset(&row[x], 0, sizeof *row * (tex->width - x));
+			}
+			return 0;
+		}
+
+		u8 packet = *p++;
+		i32 count = (packet & TGA_RLE_COUNT_MASK) + 1;
+		i32 is_run = packet & TGA_RLE_PACKET_BIT;
+		i32 packet_size = is_run ? bytes_per_pixel : count * bytes_per_pixel;
+		if (loader->end - p < packet_size) {
+			p = loader->end;
+			continue;
+		}
+
+		u32 texel = 0;
+		if (is_run)
+			tga_convert_span(&texel, p, 1, loader->format, loader);
+		while (count > 0 && y < tex->height) {
+			i32 span = min(count, tex->width - x);
+			if (is_run) {
+				for (i32 i = 0; i < span; i++)
+					row[x + i] = texel;
+			} else {
+				tga_convert_span(&row[x], p, span, loader->format, loader);
+				p += span * bytes_per_pixel;
+			}
+			count -= span;
+			x += span;
+			if (x == tex->width) {
+				tga_loader_finish_row(loader, row);
+				x = 0;
+				if (++y < tex->height)
+					row = tga_loader_row(loader, y);
+			}
+		}
+		if (is_run)
+			p += bytes_per_pixel;
+	}
+	return 1;
+} // tga_loader_decode_rle
+
+// Loads an uncompressed or run length encoded true color, grayscale or color
+// mapped TGA file and builds its mip chain. Uncompressed images are converted
+// in parallel on pool, which may be NULL. Returns NULL if the file can not be
+// read or its type is not supported.
+static inline texture_t* texture_load_from_tga(const char* filepath,
+	thread_pool_t* pool)
+{
+	printf("Loading Image File: %s\n", filepath);
+
+	file_map_t file;
+	if (!file_map(&file, filepath)) return NULL;
+
+	tga_header_t header;
+	if (file.size < sizeof header) {
+		printf("Error Loading Image File!\n\tTruncated Header\n");
+		file_unmap(&file);
+		return NULL;
+	}
+	memcpy(&header, file.data, sizeof header);
+	printf("\tImage Type: %d, %dx%d, %d Bits per Pixel\n", header.image_type,
+		header.width, header.height, header.bits_per_pixel);
+
+	tga_loader_t loader = { 0 };
+	loader.format = tga_format(header.image_type, header.bits_per_pixel);
+	loader.bytes_per_pixel = (header.bits_per_pixel + 7) >> 3;
+	loader.vertical_flip = header.image_descriptor & TGA_VERTICAL_FLIP_BIT;
+	loader.horizontal_flip = header.image_descriptor & TGA_HORIZONTAL_FLIP_BIT;
+	loader.end = file.data + file.size;
+
+	size_t offset = sizeof header + header.id_length;
+	size_t palette_size = 0;
+	tga_format_t palette_format = TGA_FORMAT_NONE;
+	if (header.color_map_type == 1) {
+		palette_format = tga_format(TGA_IMAGE_TYPE_TRUE_COLOR,
+			header.color_map_depth);
+		palette_size = (size_t) header.color_map_length *
+			((header.color_map_depth + 7) >> 3);
+	}
+
+	// NOTE: Up to 65535 squared texels, which does not fit into i32
+	size_t texel_count = (size_t) header.width * header.height;
+
+	const char* error = NULL;
+	i32 is_color_mapped = loader.format == TGA_FORMAT_INDEX8 ||
+		loader.format == TGA_FORMAT_INDEX16;
+	if (loader.format == TGA_FORMAT_NONE ||
+		(is_color_mapped && palette_format == TGA_FORMAT_NONE))
+		error = "Unsupported Image Type";
+	else if (header.width == 0 || header.height == 0)
+		error = "Empty Image";
+	else if (texel_count > TGA_TEXEL_COUNT_MAX)
+		error = "Image Too Large";
+	else if (offset + palette_size > file.size)
+		error = "Truncated Color Map";
+	if (error) {
+		printf("Error Loading Image File!\n\t%s\n", error);
+		file_unmap(&file);
+		return NULL;
+	}
+
+	if (is_color_mapped) {
+		loader.palette_start = header.color_map_start;
+		loader.palette_count = header.color_map_length;
+		loader.palette = malloc(sizeof *loader.palette *
+			(loader.palette_count ? loader.palette_count : 1));
+		tga_convert_span(loader.palette, &file.data[offset],
+			loader.palette_count, palette_format, &loader);
+	}
+	offset += palette_size;
+	loader.pixels = &file.data[offset];
+
+	texture_t* tex = calloc(1, sizeof(texture_t));
+	tex->width = header.width;
+	tex->height = header.height;
+	tex->data = malloc(sizeof *tex->data * texel_count);
+	if (tex->data == NULL) {
+		printf("Error Loading Image File!\n\tOut of Memory\n");
+		free(tex);
+		free(loader.palette);
+		file_unmap(&file);
+		return NULL;
+	}
+	loader.tex = tex;
+
+	i32 complete = 1;
+	if (header.image_type >= TGA_IMAGE_TYPE_RLE_COLOR_MAPPED) {
+		complete = tga_loader_decode_rle(&loader);
+	} else {
+		size_t row_size = (size_t) tex->width * loader.bytes_per_pixel;
+		loader.row_count = tex->height;
+		if (offset + row_size * tex->height > file.size) {
+			// NOTE: Only the complete rows are converted
+			loader.row_count = (file.size - offset) / row_size;
+			memset(tex->data, 0, sizeof *tex->data * texel_count);
+			complete = 0;
+		}
+		loader.rows_per_job = TGA_LOADER_JOB_TEXEL_COUNT / tex->width;
+		if (loader.rows_per_job < 1) loader.rows_per_job = 1;
+		i32 job_count = (loader.row_count + loader.rows_per_job - 1) /
+			loader.rows_per_job;
+		thread_pool_run(pool, job_count, tga_loader_convert_job, &loader);
+	}
+	if (!complete)
+		printf("Error Loading Image File!\n\tTruncated Image Data\n");
+
+	free(loader.palette);
+	file_unmap(&file);
+
+	texture_set_address(tex, TEXTURE_ADDRESS_WRAP);
+	tex->filter = TEXTURE_FILTER_NEAREST;
+	texture_build_mipmaps(tex);
+	texture_update_alpha_min(tex);
+	printf("\tMip Level Count: %d\n", tex->level_count);
+
+	printf("Loading Image File %s Finished\n", filepath);
+
+	return tex;
+} // texture_load_from_tga
+
+#endif // TGA_LOADER_H
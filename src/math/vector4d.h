@@ -132,6 +132,10 @@ static inline void vector4d_negate(vector4d_t* out, vector4d_t* v) {
 	out->w = -v->w;
 } // vector4d_negate
 
+static inline f32 vector4d_dot_product(vector4d_t* a, vector4d_t* b) {
+	return (a->x * b->x) + (a->y * b->y) + (a->z * b->z) + (a->w * b->w);
+} // vector4d_dot_product
+
 static inline void vector4d_lerp(vector4d_t* out, vector4d_t* a, vector4d_t* b,
 	f32 t)
 {
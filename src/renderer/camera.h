@@ -9,6 +9,14 @@
 
 #define CLIPPING_PLANES_COUNT 6
 
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+typedef enum frustum_test_t {
+	FRUSTUM_TEST_OUTSIDE = 0,
+	FRUSTUM_TEST_INTERSECTING,
+	FRUSTUM_TEST_INSIDE
+} frustum_test_t;
+
 // S T R U C T S ///////////////////////////////////////////////////////////////
 
 typedef struct camera_t {
@@ -64,61 +72,83 @@ static inline void camera_create_euler_matrix(matrix4x4_t* m, camera_t* c) {
 	matrix4x4_multiply(m, &mt, &mr);
 } // camera_create_euler_matrix
 
-// TODO: Fix clipping
+// Normalized plane a * x + b * y + c * z + d >= 0
+static inline plane3d_t camera_plane(f32 a, f32 b, f32 c, f32 d) {
+	vector3d_t normal = vector3d(a, b, c);
+	f32 length = vector3d_length(&normal);
+	vector3d_divide_float(&normal, &normal, length);
+	return plane3d(-d / length, normal);
+} // camera_plane
+
+// Extracts the camera space frustum from the columns of the projection
+// matrix. A point p is inside of a plane if dot(p, normal) >= distance.
+// NOTE: vertex3d_project_to_screen divides by the projected z instead of w,
+//       so the side planes are |x| <= z and |y| <= z after projection and the
+//       near plane is z >= 0
 static inline void camera_create_clipping_planes(camera_t* camera,
-	framebuffer_t* fb)
+	matrix4x4_t* projection)
 {
-	f32 clip_dir_x, clip_dir_y, clip_dir_z;
-	f32 aspect = (f32) fb->height / (f32) fb->width;
-	f32 half_fov = camera->fov * 0.5f;
-	f32 half_fov_aspect = half_fov * aspect;
+	f32* e = projection->e;
+	f32 x[4] = { e[0], e[4], e[8], e[12] };
+	f32 y[4] = { e[1], e[5], e[9], e[13] };
+	f32 z[4] = { e[2], e[6], e[10], e[14] };
+	f32 w[4] = { e[3], e[7], e[11], e[15] };
 
 	// Near Plane
-	camera->clipping_planes[0] = plane3d(
-		camera->z_near,
-		vector3d(0.0f, 0.0f, 1.0f)
-	);
+	camera->clipping_planes[0] = camera_plane(z[0], z[1], z[2], z[3]);
 	// Far Plane
-	camera->clipping_planes[1] = plane3d(
-		-camera->z_far,
-		vector3d(0.0f, 0.0f, -1.0f)
+	camera->clipping_planes[1] = camera_plane(
+		w[0] - z[0], w[1] - z[1], w[2] - z[2], w[3] - z[3]
 	);
 	// Left Plane
-	clip_dir_x = 0.0f - gf_sin(half_fov_aspect);
-	clip_dir_z = 1.0f + gf_cos(half_fov_aspect);
-	vector3d_t clip_dir = vector3d(clip_dir_x, 0.0f, clip_dir_z);
-	vector3d_normalize(&clip_dir, &clip_dir);
-	camera->clipping_planes[2] = plane3d(
-		0,
-		clip_dir
+	camera->clipping_planes[2] = camera_plane(
+		z[0] + x[0], z[1] + x[1], z[2] + x[2], z[3] + x[3]
 	);
 	// Right Plane
-	clip_dir_x = 0.0f + gf_sin(half_fov_aspect);
-	clip_dir_z = 1.0f + gf_cos(half_fov_aspect);
-	clip_dir = vector3d(clip_dir_x, 0.0f, clip_dir_z);
-	vector3d_normalize(&clip_dir, &clip_dir);
-	camera->clipping_planes[3] = plane3d(
-		0,
-		clip_dir
+	camera->clipping_planes[3] = camera_plane(
+		z[0] - x[0], z[1] - x[1], z[2] - x[2], z[3] - x[3]
 	);
 	// Top Plane
-	clip_dir_y = 0.0f - gf_sin(half_fov);
-	clip_dir_z = 1.0f + gf_cos(half_fov);
-	clip_dir = vector3d(0.0f, clip_dir_y, clip_dir_z);
-	vector3d_normalize(&clip_dir, &clip_dir);
-	camera->clipping_planes[4] = plane3d(
-		0,
-		clip_dir
+	camera->clipping_planes[4] = camera_plane(
+		z[0] - y[0], z[1] - y[1], z[2] - y[2], z[3] - y[3]
 	);
 	// Bottom Plane
-	clip_dir_y = 0.0f + gf_sin(half_fov);
-	clip_dir_z = 1.0f + gf_cos(half_fov);
-	clip_dir = vector3d(0.0f, clip_dir_y, clip_dir_z);
-	vector3d_normalize(&clip_dir, &clip_dir);
-	camera->clipping_planes[5] = plane3d(
-		0,
-		clip_dir
+	camera->clipping_planes[5] = camera_plane(
+		z[0] + y[0], z[1] + y[1], z[2] + y[2], z[3] + y[3]
 	);
 } // camera_create_clipping_planes
 
+// Tests a sphere given in camera space against the clipping planes
+static inline frustum_test_t camera_test_sphere(camera_t* camera,
+	point3d_t* center, f32 radius)
+{
+	frustum_test_t result = FRUSTUM_TEST_INSIDE;
+	for (i32 i = 0; i < CLIPPING_PLANES_COUNT; i++) {
+		plane3d_t* p = &camera->clipping_planes[i];
+		f32 d = vector3d_dot_product(center, &p->normal) - p->distance;
+		if (d < -radius) return FRUSTUM_TEST_OUTSIDE;
+		if (d < radius) result = FRUSTUM_TEST_INTERSECTING;
+	}
+	return result;
+} // camera_test_sphere
+
+// Tests the convex hull of points given in camera space against the
+// clipping planes, the hull is outside if all points are outside of one plane
+static inline frustum_test_t camera_test_points(camera_t* camera,
+	point4d_t* points, i32 count)
+{
+	frustum_test_t result = FRUSTUM_TEST_INSIDE;
+	for (i32 i = 0; i < CLIPPING_PLANES_COUNT; i++) {
+		plane3d_t* p = &camera->clipping_planes[i];
+		i32 outside_count = 0;
+		for (i32 j = 0; j < count; j++) {
+			f32 dot = vector3d_dot_product(&points[j].xyz, &p->normal);
+			if (!(dot >= p->distance)) outside_count++;
+		}
+		if (outside_count == count) return FRUSTUM_TEST_OUTSIDE;
+		if (outside_count > 0) result = FRUSTUM_TEST_INTERSECTING;
+	}
+	return result;
+} // camera_test_points
+
 #endif // CAMERA_H
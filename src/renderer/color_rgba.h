@@ -1,6 +1,11 @@
 #ifndef COLOR_RGBA_H
 #define COLOR_RGBA_H
 
+#if defined(__SSE2__) && !defined(RENDERER_NO_SIMD)
+	#define COLOR_RGBA_SSE2
+	#include <emmintrin.h>
+#endif
+
 #include "../math/mathlib.h"
 
 // D E F I N E S ///////////////////////////////////////////////////////////////
@@ -29,6 +34,16 @@ typedef union color_rgba_t {
 	f32 e[4];
 } color_rgba_t;
 
+// NOTE: Bit offsets of the channels of a packed image_format_t, see
+//       color_layout. Code that packs many pixels looks the layout up once
+//       instead of switching on the format per pixel.
+typedef struct color_layout_t {
+	i32 shift_r;
+	i32 shift_g;
+	i32 shift_b;
+	i32 shift_a;
+} color_layout_t;
+
 // F U N C T I O N S ///////////////////////////////////////////////////////////
 
 static inline void color_swap(color_rgba_t* color1, color_rgba_t* color2) {
@@ -84,24 +99,50 @@ static inline void color_from_argb(color_rgba_t* out, u32 color) {
 	out->b = (f32) b / 255.0f;
 } // color_from_argb
 
-static inline u32 color_to_u32(color_rgba_t* color, image_format_t image_format)
-{
-	u32 c;
+// NOTE: With RENDERER_IMAGE_FORMAT defined every image uses that format and
+//       image_format is ignored, so the layout is a compile time constant
+//       and the packing code is specialized for it
+static inline color_layout_t color_layout(image_format_t image_format) {
+#ifdef RENDERER_IMAGE_FORMAT
+	(void) image_format;
+	image_format = RENDERER_IMAGE_FORMAT;
+#endif
 	switch (image_format) {
+		case IMAGE_FORMAT_ARGB: return (color_layout_t) { 16, 8, 0, 24 };
+		case IMAGE_FORMAT_ABGR: return (color_layout_t) { 0, 8, 16, 24 };
 		case IMAGE_FORMAT_RGBA:
-			c = color_to_rgba(color);
-			break;
-		case IMAGE_FORMAT_ARGB:
-			c = color_to_argb(color);
-			break;
-		case IMAGE_FORMAT_ABGR:
-			c = color_to_abgr(color);
-			break;
-		default:
-			c = color_to_rgba(color);
-			break;
+		default: return (color_layout_t) { 24, 16, 8, 0 };
 	}
-	return c;
+} // color_layout
+
+// Packs channels in [0, 255]
+static inline u32 color_pack(color_layout_t* layout, u32 r, u32 g, u32 b,
+	u32 a)
+{
+	return r << layout->shift_r | g << layout->shift_g |
+		b << layout->shift_b | a << layout->shift_a;
+} // color_pack
+
+// Packs a color with channels in [0, 1], the same as color_to_rgba and the
+// others. All channels are converted at once with SSE2.
+static inline u32 color_pack_float(color_layout_t* layout,
+	color_rgba_t* color)
+{
+#ifdef COLOR_RGBA_SSE2
+	u32 e[4];
+	_mm_storeu_si128((__m128i *) e, _mm_cvttps_epi32(
+		_mm_mul_ps(_mm_loadu_ps(color->e), _mm_set1_ps(255.0f))));
+	return color_pack(layout, e[0], e[1], e[2], e[3]);
+#else
+	return color_pack(layout, color->r * 255.0f, color->g * 255.0f,
+		color->b * 255.0f, color->a * 255.0f);
+#endif
+} // color_pack_float
+
+static inline u32 color_to_u32(color_rgba_t* color, image_format_t image_format)
+{
+	color_layout_t layout = color_layout(image_format);
+	return color_pack_float(&layout, color);
 } // color_to_u32
 
 #endif // COLOR_RGBA_H
@@ -1,6 +1,8 @@
 #ifndef RENDER_ENTITY3D_H
 #define RENDER_ENTITY3D_H
 
+#include <stdlib.h>
+
 #include "../math/mathlib.h"
 
 #include "camera.h"
@@ -9,11 +11,18 @@
 #include "vertex3d.h"
 #include "face3d.h"
 #include "color_rgba.h"
+#include "vertex_cache3d.h"
 
 // D E F I N E S ///////////////////////////////////////////////////////////////
 
 // S T R U C T S ///////////////////////////////////////////////////////////////
 
+// NOTE: The faces point into the contiguous indices array. triangle_indices
+//       holds three vertex cache indices per triangle, see
+//       render_entity3d_triangulate. If mapping is set, the mesh arrays are
+//       read only and live in that memory mapping instead of the heap. The
+//       bounds are in local space, the bounding sphere is centered at the
+//       center of the box, see render_entity3d_compute_bounds.
 typedef struct render_entity3d_t {
 	u32 vertex_count;
 	point4d_t* vertices;
@@ -21,12 +30,38 @@ typedef struct render_entity3d_t {
 	point2d_t* texcoords;
 	u32 normal_count;
 	vector4d_t* normals;
+	u32 index_count;
+	index3d_t* indices;
 	u32 face_count;
 	face3d_t* faces;
+	vertex_cache3d_t vertex_cache;
+	u32 triangle_count;
+	u32* triangle_indices;
+	point4d_t bounds_min;
+	point4d_t bounds_max;
+	f32 bounds_radius;
 	u32 material_index;
 	transform4d_t transform;
+	void* mapping;
+	size_t mapping_size;
 } render_entity3d_t;
 
+// NOTE: One placement of a shared mesh. The vertex colors are multiplied by
+//       tint before lighting, white leaves them unchanged.
+typedef struct render_instance3d_t {
+	transform4d_t transform;
+	color_rgba_t tint;
+} render_instance3d_t;
+
+// NOTE: Draws the mesh of entity once per instance. The instances share its
+//       geometry, bounds and material, the transform of the entity itself
+//       is not used. The entity does not have to be in the entity array.
+typedef struct render_instance_batch3d_t {
+	render_entity3d_t* entity;
+	u32 instance_count;
+	render_instance3d_t* instances;
+} render_instance_batch3d_t;
+
 // F U N C T I O N S ///////////////////////////////////////////////////////////
 
 static inline void render_entity3d_create_rotation_matrix(matrix4x4_t* out,
@@ -67,4 +102,63 @@ static inline void render_entity3d_create_inverse_scale_matrix(matrix4x4_t* out,
 	);
 } // render_entity3d_create_inverse_scale_matrix
 
+// Fan triangulates every face into the triangle index buffer, has to be
+// called after vertex_cache3d_build
+static inline void render_entity3d_triangulate(render_entity3d_t* entity) {
+	u32 triangle_count = 0;
+	for (u32 i = 0; i < entity->face_count; i++) {
+		if (entity->faces[i].index_count >= 3)
+			triangle_count += entity->faces[i].index_count - 2;
+	}
+
+	entity->triangle_count = triangle_count;
+	entity->triangle_indices = malloc(sizeof *entity->triangle_indices *
+		(triangle_count ? triangle_count * 3 : 1));
+
+	u32* out = entity->triangle_indices;
+	for (u32 i = 0; i < entity->face_count; i++) {
+		face3d_t* face = &entity->faces[i];
+		for (u32 j = 1; j + 1 < face->index_count; j++) {
+			*out++ = face->cache_indices[0];
+			*out++ = face->cache_indices[j];
+			*out++ = face->cache_indices[j + 1];
+		}
+	}
+} // render_entity3d_triangulate
+
+// Axis aligned box and bounding sphere of the vertices, has to be called
+// whenever the vertices change
+static inline void render_entity3d_compute_bounds(render_entity3d_t* entity) {
+	point4d_t* vertices = entity->vertices;
+	entity->bounds_min = point4d(0.0f, 0.0f, 0.0f);
+	entity->bounds_max = point4d(0.0f, 0.0f, 0.0f);
+	entity->bounds_radius = 0.0f;
+	if (entity->vertex_count == 0) return;
+
+	entity->bounds_min = point4d(vertices[0].x, vertices[0].y, vertices[0].z);
+	entity->bounds_max = entity->bounds_min;
+	for (u32 i = 1; i < entity->vertex_count; i++) {
+		for (i32 j = 0; j < 3; j++) {
+			f32 value = vertices[i].e[j];
+			if (value < entity->bounds_min.e[j])
+				entity->bounds_min.e[j] = value;
+			if (value > entity->bounds_max.e[j])
+				entity->bounds_max.e[j] = value;
+		}
+	}
+
+	vector3d_t center;
+	vector3d_add(&center, &entity->bounds_min.xyz, &entity->bounds_max.xyz);
+	vector3d_multiply_float(&center, &center, 0.5f);
+	vector3d_t farthest = vector3d(0.0f, 0.0f, 0.0f);
+	for (u32 i = 0; i < entity->vertex_count; i++) {
+		vector3d_t d;
+		vector3d_subtract(&d, &vertices[i].xyz, &center);
+		if (vector3d_length_sqr(&d) > vector3d_length_sqr(&farthest))
+			farthest = d;
+	}
+	// NOTE: Rounded up slightly so that the sphere stays conservative
+	entity->bounds_radius = vector3d_length(&farthest) * 1.0001f;
+} // render_entity3d_compute_bounds
+
 #endif // RENDER_ENTITY3D_H
@@ -17,6 +17,7 @@
 typedef struct face3d_t {
 	u32 index_count;
 	index3d_t* indices;
+	u32* cache_indices;
 } face3d_t;
 
 #endif // FACE3D_H
@@ -1,50 +1,416 @@
 #ifndef FRAMEBUFFER_H
 #define FRAMEBUFFER_H
 
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) && !defined(RENDERER_NO_SIMD)
+	#define FRAMEBUFFER_SSE2
+	#include <emmintrin.h>
+#endif
+
 #include "../math/mathlib.h"
 
 #include "color_rgba.h"
 
 // D E F I N E S ///////////////////////////////////////////////////////////////
 
+#define FRAMEBUFFER_DEPTH_BLOCK_SIZE 8
+// The tiles of FRAMEBUFFER_LAYOUT_TILED are the depth blocks
+#define FRAMEBUFFER_TILE_SIZE FRAMEBUFFER_DEPTH_BLOCK_SIZE
+#define FRAMEBUFFER_TILE_PIXEL_COUNT \
+	(FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE)
+// Elements from one tile to the next, the tile holds its color, depth and
+// visibility values one after another
+#define FRAMEBUFFER_TILE_STRIDE (3 * FRAMEBUFFER_TILE_PIXEL_COUNT)
+// Value of the visibility buffer where no triangle is visible
+#define FRAMEBUFFER_VISIBILITY_NONE 0xFFFFFFFF
+// Full clears of planes with at least this many bytes use non-temporal
+// stores, the planes of smaller framebuffers stay in the cache for drawing
+#define FRAMEBUFFER_STREAM_CLEAR_SIZE (4 << 20)
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+// NOTE: In the linear layout color, depth and visibility are row-major
+//       arrays. In the tiled layout the pixels are stored tile by tile,
+//       row-major inside of a tile, and the color, depth and visibility
+//       values of a tile are next to each other in memory. A span inside
+//       of one tile row is contiguous in both layouts, so the rasterizer
+//       only needs framebuffer_row_offset once per tile row. The color has
+//       to be copied out with framebuffer_detile for presenting.
+typedef enum framebuffer_layout_t {
+	FRAMEBUFFER_LAYOUT_LINEAR = 0,
+	FRAMEBUFFER_LAYOUT_TILED
+} framebuffer_layout_t;
+
 // S T R U C T S ///////////////////////////////////////////////////////////////
 
+// NOTE: color, depth and visibility point into memory and are indexed with
+//       framebuffer_index, see framebuffer_layout_t. The layout is applied
+//       by framebuffer_resize. depth_max holds an upper bound of the depth
+//       of every FRAMEBUFFER_DEPTH_BLOCK_SIZE squared block. Depth writes
+//       only lower the depth, so the bound stays valid until the next clear
+//       even if a writer does not update it. It is optional and may be
+//       NULL. visibility holds the id of the visible triangle of every
+//       pixel in the visibility buffer mode of the renderer. The tiled
+//       layout always has it, the linear layout only if visibility_plane
+//       is set, otherwise it is NULL.
+//       clear_pending is set for the blocks cleared by clear_rect_lazy.
+//       Their color is clear_value, but it is only written by
+//       framebuffer_detile.
 typedef struct framebuffer_t {
 	image_format_t image_format;
+	framebuffer_layout_t layout;
 	i32 width;
 	i32 height;
 	f32* depth;
 	u32* color;
+	i32 depth_blocks_x;
+	i32 depth_blocks_y;
+	f32* depth_max;
+	u32* visibility;
+	i32 visibility_plane;
+	u32* memory;
+	u8* clear_pending;
+	u32 clear_value;
 } framebuffer_t;
 
 // F U N C T I O N S ///////////////////////////////////////////////////////////
 
+static inline i32 framebuffer_index(framebuffer_t* fb, i32 x, i32 y) {
+	if (fb->layout == FRAMEBUFFER_LAYOUT_LINEAR) return y * fb->width + x;
+
+	const u32 ts = FRAMEBUFFER_TILE_SIZE;
+	u32 tile = ((u32) y / ts) * fb->depth_blocks_x + (u32) x / ts;
+	return tile * FRAMEBUFFER_TILE_STRIDE + ((u32) y % ts) * ts + (u32) x % ts;
+} // framebuffer_index
+
+// Offset of row y such that offset + x' is the index of pixel (x', y) for
+// every x' in the same tile as x. Never negative.
+static inline i32 framebuffer_row_offset(framebuffer_t* fb, i32 x, i32 y) {
+	return framebuffer_index(fb, x, y) - x;
+} // framebuffer_row_offset
+
+// Number of values in each of the color, depth and visibility planes,
+// including the padding of the tiles at the border in the tiled layout
+static inline i32 framebuffer_plane_size(framebuffer_t* fb) {
+	if (fb->layout == FRAMEBUFFER_LAYOUT_LINEAR) return fb->width * fb->height;
+	return fb->depth_blocks_x * fb->depth_blocks_y * FRAMEBUFFER_TILE_STRIDE;
+} // framebuffer_plane_size
+
+// Whether full clears of the planes should bypass the cache
+static inline i32 framebuffer_stream_clear(framebuffer_t* fb) {
+	return (i64) fb->width * fb->height * sizeof *fb->color >=
+		FRAMEBUFFER_STREAM_CLEAR_SIZE;
+} // framebuffer_stream_clear
+
+// Writes value to count colors, with non-temporal stores if stream is set.
+// Streamed stores have to be ordered with framebuffer_stream_fence.
+static inline void framebuffer_fill_color(u32* dst, u32 value, i32 count,
+	i32 stream)
+{
+	i32 i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	if (stream) {
+		for (; i < count && ((uintptr_t) &dst[i] & 15); i++) dst[i] = value;
+		__m128i v = _mm_set1_epi32(value);
+		for (; i + 4 <= count; i += 4)
+			_mm_stream_si128((__m128i *) &dst[i], v);
+	}
+#else
+	(void) stream;
+#endif
+	for (; i < count; i++) dst[i] = value;
+} // framebuffer_fill_color
+
+// Depth version of framebuffer_fill_color
+static inline void framebuffer_fill_depth(f32* dst, f32 value, i32 count,
+	i32 stream)
+{
+	i32 i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	if (stream) {
+		for (; i < count && ((uintptr_t) &dst[i] & 15); i++) dst[i] = value;
+		__m128 v = _mm_set1_ps(value);
+		for (; i + 4 <= count; i += 4)
+			_mm_stream_ps(&dst[i], v);
+	}
+#else
+	(void) stream;
+#endif
+	for (; i < count; i++) dst[i] = value;
+} // framebuffer_fill_depth
+
+static inline void framebuffer_stream_fence() {
+#ifdef FRAMEBUFFER_SSE2
+	_mm_sfence();
+#endif
+} // framebuffer_stream_fence
+
 static inline void clear_color(framebuffer_t* fb, color_rgba_t* color) {
 	u32 c = color_to_u32(color, fb->image_format);
-	for (i32 i = 0; i < fb->width * fb->height; i++)
-		fb->color[i] = c;
+	i32 stream = framebuffer_stream_clear(fb);
+	if (fb->layout == FRAMEBUFFER_LAYOUT_LINEAR) {
+		framebuffer_fill_color(fb->color, c, fb->width * fb->height, stream);
+	} else {
+		i32 size = framebuffer_plane_size(fb);
+		for (i32 i = 0; i < size; i += FRAMEBUFFER_TILE_STRIDE) {
+			framebuffer_fill_color(&fb->color[i], c,
+				FRAMEBUFFER_TILE_PIXEL_COUNT, stream);
+		}
+	}
+	if (stream) framebuffer_stream_fence();
+	memset(fb->clear_pending, 0, fb->depth_blocks_x * fb->depth_blocks_y);
 } // clear_color
 
 static inline void clear_depth(framebuffer_t* fb, f32 depth) {
-	for (i32 i = 0; i < fb->width * fb->height; i++)
-		fb->depth[i] = depth;
+	i32 stream = framebuffer_stream_clear(fb);
+	if (fb->layout == FRAMEBUFFER_LAYOUT_LINEAR) {
+		framebuffer_fill_depth(fb->depth, depth, fb->width * fb->height,
+			stream);
+	} else {
+		i32 size = framebuffer_plane_size(fb);
+		for (i32 i = 0; i < size; i += FRAMEBUFFER_TILE_STRIDE) {
+			framebuffer_fill_depth(&fb->depth[i], depth,
+				FRAMEBUFFER_TILE_PIXEL_COUNT, stream);
+		}
+	}
+	if (stream) framebuffer_stream_fence();
+	if (fb->depth_max == NULL) return;
+	for (i32 i = 0; i < fb->depth_blocks_x * fb->depth_blocks_y; i++)
+		fb->depth_max[i] = depth;
 } // clear_depth
 
+// Clears color and depth of the whole framebuffer in one pass
+static inline void clear_color_depth(framebuffer_t* fb, color_rgba_t* color,
+	f32 depth)
+{
+	if (fb->layout == FRAMEBUFFER_LAYOUT_LINEAR) {
+		clear_color(fb, color);
+		clear_depth(fb, depth);
+		return;
+	}
+
+	// NOTE: The planes of a tile are adjacent, so the whole memory is
+	//       written front to back. The visibility is cleared as well, since
+	//       skipping it leaves gaps that make streamed stores a lot slower.
+	u32 c = color_to_u32(color, fb->image_format);
+	i32 stream = framebuffer_stream_clear(fb);
+	i32 size = framebuffer_plane_size(fb);
+	for (i32 i = 0; i < size; i += FRAMEBUFFER_TILE_STRIDE) {
+		framebuffer_fill_color(&fb->color[i], c,
+			FRAMEBUFFER_TILE_PIXEL_COUNT, stream);
+		framebuffer_fill_depth(&fb->depth[i], depth,
+			FRAMEBUFFER_TILE_PIXEL_COUNT, stream);
+		framebuffer_fill_color(&fb->visibility[i],
+			FRAMEBUFFER_VISIBILITY_NONE, FRAMEBUFFER_TILE_PIXEL_COUNT, stream);
+	}
+	if (stream) framebuffer_stream_fence();
+	memset(fb->clear_pending, 0, fb->depth_blocks_x * fb->depth_blocks_y);
+	if (fb->depth_max == NULL) return;
+	for (i32 i = 0; i < fb->depth_blocks_x * fb->depth_blocks_y; i++)
+		fb->depth_max[i] = depth;
+} // clear_color_depth
+
+// Clears [x_min, x_max) x [y_min, y_max), the rectangle has to start at a
+// depth block and end at a depth block or the border of the framebuffer
+static inline void clear_rect(framebuffer_t* fb, color_rgba_t* color,
+	f32 depth, i32 x_min, i32 y_min, i32 x_max, i32 y_max)
+{
+	const i32 bs = FRAMEBUFFER_DEPTH_BLOCK_SIZE;
+	u32 c = color_to_u32(color, fb->image_format);
+	for (i32 y = y_min; y < y_max; y++) {
+		for (i32 bx = x_min; bx < x_max; bx += bs) {
+			i32 offset = framebuffer_row_offset(fb, bx, y);
+			i32 end = min(bx + bs, x_max);
+			for (i32 x = bx; x < end; x++) {
+				fb->color[offset + x] = c;
+				fb->depth[offset + x] = depth;
+			}
+		}
+	}
+
+	for (i32 by = y_min / bs; by < (y_max + bs - 1) / bs; by++) {
+		for (i32 bx = x_min / bs; bx < (x_max + bs - 1) / bs; bx++) {
+			i32 block_index = by * fb->depth_blocks_x + bx;
+			fb->clear_pending[block_index] = 0;
+			if (fb->depth_max) fb->depth_max[block_index] = depth;
+		}
+	}
+} // clear_rect
+
+// Clears the color of [x_min, x_max) x [y_min, y_max) to fb->clear_value
+// like clear_rect but only marks its blocks, framebuffer_detile writes the
+// color. The depth of the blocks is undefined, so they must not be drawn to
+// before the next clear. clear_value is not written here, so concurrent
+// lazy clears of disjoint rectangles are safe; it has to be set before.
+static inline void clear_rect_lazy(framebuffer_t* fb, i32 x_min, i32 y_min,
+	i32 x_max, i32 y_max)
+{
+	const i32 bs = FRAMEBUFFER_DEPTH_BLOCK_SIZE;
+	for (i32 by = y_min / bs; by < (y_max + bs - 1) / bs; by++) {
+		for (i32 bx = x_min / bs; bx < (x_max + bs - 1) / bs; bx++)
+			fb->clear_pending[by * fb->depth_blocks_x + bx] = 1;
+	}
+} // clear_rect_lazy
+
+// Clears depth and visibility of [x_min, x_max) x [y_min, y_max) but not
+// the color, with the same restrictions as clear_rect
+static inline void clear_visibility_rect(framebuffer_t* fb, f32 depth,
+	i32 x_min, i32 y_min, i32 x_max, i32 y_max)
+{
+	const i32 bs = FRAMEBUFFER_DEPTH_BLOCK_SIZE;
+	for (i32 y = y_min; y < y_max; y++) {
+		for (i32 bx = x_min; bx < x_max; bx += bs) {
+			i32 offset = framebuffer_row_offset(fb, bx, y);
+			i32 end = min(bx + bs, x_max);
+			for (i32 x = bx; x < end; x++) {
+				fb->depth[offset + x] = depth;
+				fb->visibility[offset + x] = FRAMEBUFFER_VISIBILITY_NONE;
+			}
+		}
+	}
+
+	// NOTE: The color is written by the shading pass, so the blocks are
+	//       no longer pending
+	for (i32 by = y_min / bs; by < (y_max + bs - 1) / bs; by++) {
+		for (i32 bx = x_min / bs; bx < (x_max + bs - 1) / bs; bx++) {
+			i32 block_index = by * fb->depth_blocks_x + bx;
+			fb->clear_pending[block_index] = 0;
+			if (fb->depth_max) fb->depth_max[block_index] = depth;
+		}
+	}
+} // clear_visibility_rect
+
+// Recomputes the depth bound of block (block_x, block_y) after writes
+static inline void framebuffer_update_depth_max(framebuffer_t* fb,
+	i32 block_x, i32 block_y)
+{
+	const i32 bs = FRAMEBUFFER_DEPTH_BLOCK_SIZE;
+	i32 x_min = block_x * bs;
+	i32 y_min = block_y * bs;
+	i32 x_max = min(x_min + bs, fb->width);
+	i32 y_max = min(y_min + bs, fb->height);
+
+	f32 depth_max = fb->depth[framebuffer_index(fb, x_min, y_min)];
+	for (i32 y = y_min; y < y_max; y++) {
+		f32* depth_row = &fb->depth[framebuffer_row_offset(fb, x_min, y)];
+		for (i32 x = x_min; x < x_max; x++) {
+			if (depth_row[x] > depth_max) depth_max = depth_row[x];
+		}
+	}
+	fb->depth_max[block_y * fb->depth_blocks_x + block_x] = depth_max;
+} // framebuffer_update_depth_max
+
+// (Re)allocates the buffers in fb->layout, the contents are undefined until
+// cleared
+static inline void framebuffer_resize(framebuffer_t* fb, i32 width,
+	i32 height)
+{
+	const i32 bs = FRAMEBUFFER_DEPTH_BLOCK_SIZE;
+	fb->width = width;
+	fb->height = height;
+	fb->depth_blocks_x = (width + bs - 1) / bs;
+	fb->depth_blocks_y = (height + bs - 1) / bs;
+	fb->depth_max = realloc(fb->depth_max, sizeof *fb->depth_max *
+		fb->depth_blocks_x * fb->depth_blocks_y);
+	fb->clear_pending = realloc(fb->clear_pending,
+		fb->depth_blocks_x * fb->depth_blocks_y);
+	memset(fb->clear_pending, 0, fb->depth_blocks_x * fb->depth_blocks_y);
+
+	// NOTE: The planes share one allocation, in the tiled layout they are
+	//       interleaved tile by tile and all of them span the whole memory.
+	//       The linear layout stores the visibility plane last, so it can be
+	//       left out.
+	i32 size = framebuffer_plane_size(fb);
+	i32 plane_offset = FRAMEBUFFER_TILE_PIXEL_COUNT;
+	i32 visibility = 1;
+	if (fb->layout == FRAMEBUFFER_LAYOUT_LINEAR) {
+		visibility = fb->visibility_plane;
+		plane_offset = size;
+		size *= visibility ? 3 : 2;
+	}
+	fb->memory = realloc(fb->memory, sizeof *fb->memory * size);
+	fb->color = fb->memory;
+	fb->depth = (f32*) (fb->memory + plane_offset);
+	fb->visibility = visibility ? fb->memory + 2 * plane_offset : NULL;
+} // framebuffer_resize
+
+// Adds the visibility plane to a linear framebuffer that was allocated
+// without it, the contents of the other planes are kept
+static inline void framebuffer_require_visibility(framebuffer_t* fb) {
+	fb->visibility_plane = 1;
+	if (fb->visibility != NULL || fb->memory == NULL) return;
+
+	i32 size = framebuffer_plane_size(fb);
+	fb->memory = realloc(fb->memory, sizeof *fb->memory * 3 * size);
+	fb->color = fb->memory;
+	fb->depth = (f32*) (fb->memory + size);
+	fb->visibility = fb->memory + 2 * size;
+} // framebuffer_require_visibility
+
+static inline void framebuffer_free(framebuffer_t* fb) {
+	free(fb->memory);
+	free(fb->depth_max);
+	free(fb->clear_pending);
+	fb->memory = NULL;
+	fb->clear_pending = NULL;
+	fb->color = NULL;
+	fb->depth = NULL;
+	fb->depth_max = NULL;
+	fb->visibility = NULL;
+} // framebuffer_free
+
 static inline void set_pixel(framebuffer_t* fb, i32 x, i32 y,
 	color_rgba_t* color)
 {
 	u32 c = color_to_u32(color, fb->image_format);
-	fb->color[y * fb->width + x] = c;
+	fb->color[framebuffer_index(fb, x, y)] = c;
 } // set_pixel
 
+// set_pixel for a color packed in the format of the framebuffer
+static inline void set_pixel_packed(framebuffer_t* fb, i32 x, i32 y, u32 c) {
+	fb->color[framebuffer_index(fb, x, y)] = c;
+} // set_pixel_packed
+
 static inline void set_depth(framebuffer_t* fb, i32 x, i32 y, f32 depth) {
-	fb->depth[y * fb->width + x] = depth;
+	fb->depth[framebuffer_index(fb, x, y)] = depth;
 } // set_depth
 
 static inline f32 get_depth(framebuffer_t* fb, i32 x, i32 y) {
 	if (x < 0 || x >= fb->width) return -1.0f;
 	if (y < 0 || y >= fb->height) return -1.0f;
-	return fb->depth[y * fb->width + x];
+	return fb->depth[framebuffer_index(fb, x, y)];
 } // get_depth
 
+// Copies the color to the row-major out with pitch pixels per row and
+// fills the blocks of pending lazy clears
+static inline void framebuffer_detile(framebuffer_t* fb, u32* out, i32 pitch) {
+	const i32 ts = FRAMEBUFFER_TILE_SIZE;
+	i32 row_stride = fb->layout == FRAMEBUFFER_LAYOUT_LINEAR ? fb->width : ts;
+	for (i32 ty = 0; ty < fb->depth_blocks_y; ty++) {
+		i32 y_min = ty * ts;
+		i32 y_max = min(y_min + ts, fb->height);
+		u8* pending = &fb->clear_pending[ty * fb->depth_blocks_x];
+		for (i32 x = 0; x < fb->width; x += ts) {
+			i32 width = min(ts, fb->width - x);
+			if (pending[x / ts]) {
+				for (i32 y = y_min; y < y_max; y++) {
+					framebuffer_fill_color(&out[y * pitch + x],
+						fb->clear_value, width, 0);
+				}
+				continue;
+			}
+			u32* src = &fb->color[framebuffer_index(fb, x, y_min)];
+			for (i32 y = y_min; y < y_max; y++, src += row_stride) {
+				// NOTE: Constant size so that the copy is inlined
+				if (width == ts)
+					memcpy(&out[y * pitch + x], src, sizeof *out * ts);
+				else
+					memcpy(&out[y * pitch + x], src, sizeof *out * width);
+			}
+		}
+	}
+} // framebuffer_detile
+
 #endif // FRAMEBUFFER_H
@@ -22,12 +22,15 @@ typedef struct line3d_t {
 
 // F U N C T I O N S ///////////////////////////////////////////////////////////
 
-static inline void line3d_stroke(framebuffer_t* fb, line3d_t* line) {
+// Only pixels inside of [x_min, x_max) x [y_min, y_max) are written
+static inline void line3d_stroke_rect(framebuffer_t* fb, line3d_t* line,
+	i32 x_min, i32 y_min, i32 x_max, i32 y_max)
+{
 	i32 x_start = line->start.position.x;
 	i32 y_start = line->start.position.y;
 	i32 x_end = line->end.position.x;
 	i32 y_end = line->end.position.y;
-	color_rgba_t color = line->start.color;
+	u32 color = color_to_u32(&line->start.color, fb->image_format);
 
 	i32 dx = x_end - x_start;
 	i32 dy = y_end - y_start;
@@ -42,7 +45,8 @@ static inline void line3d_stroke(framebuffer_t* fb, line3d_t* line) {
 	i32 error = 0;
 	if (dx > dy) {
 		for (i32 i = 0; i < dx; i++) {
-			set_pixel(fb, x, y, &color);
+			if (x >= x_min && x < x_max && y >= y_min && y < y_max)
+				set_pixel_packed(fb, x, y, color);
 			x += x_incr;
 			error += dy;
 			if (error > dx) {
@@ -52,7 +56,8 @@ static inline void line3d_stroke(framebuffer_t* fb, line3d_t* line) {
 		}
 	} else {
 		for (i32 i = 0; i < dy; i++) {
-			set_pixel(fb, x, y, &color);
+			if (x >= x_min && x < x_max && y >= y_min && y < y_max)
+				set_pixel_packed(fb, x, y, color);
 			y += y_incr;
 			error += dx;
 			if (error > dy) {
@@ -61,6 +66,10 @@ static inline void line3d_stroke(framebuffer_t* fb, line3d_t* line) {
 			}
 		}
 	}
+} // line3d_stroke_rect
+
+static inline void line3d_stroke(framebuffer_t* fb, line3d_t* line) {
+	line3d_stroke_rect(fb, line, 0, 0, fb->width, fb->height);
 } // line3d_stroke
 
 #endif // LINE3D_H
@@ -57,21 +57,20 @@ static inline void polygon3d_project_to_screen(polygon3d_t* out,
 	}
 } // polygon3d_project_to_screen
 
-static inline u8 polygon3d_cull(polygon3d_t* poly, point3d_t* cam_pos) {
-	point3d_t p1 = poly->vertices[0].position.xyz;
-	point3d_t p2 = poly->vertices[1].position.xyz;
-	point3d_t p3 = poly->vertices[2].position.xyz;
-
+// Returns 1 if the triangle p1, p2, p3 faces away from cam_pos
+static inline u8 polygon3d_cull_points(point3d_t* p1, point3d_t* p2,
+	point3d_t* p3, point3d_t* cam_pos)
+{
 	vector3d_t l1;
-	vector3d_subtract(&l1, &p1, &p2);
+	vector3d_subtract(&l1, p1, p2);
 	vector3d_t l2;
-	vector3d_subtract(&l2, &p1, &p3);
+	vector3d_subtract(&l2, p1, p3);
 	vector3d_t n;
 	vector3d_cross_product(&n, &l1, &l2);
 	vector3d_t n_normalized;
 	vector3d_normalize(&n_normalized, &n);
 	vector3d_t p;
-	vector3d_subtract(&p, &p1, cam_pos);
+	vector3d_subtract(&p, p1, cam_pos);
 
 	f32 dot_product = vector3d_dot_product(
 		&n_normalized,
@@ -80,6 +79,15 @@ static inline u8 polygon3d_cull(polygon3d_t* poly, point3d_t* cam_pos) {
 
 	if (dot_product > 0.0f) return 1;
 	return 0;
+} // polygon3d_cull_points
+
+static inline u8 polygon3d_cull(polygon3d_t* poly, point3d_t* cam_pos) {
+	return polygon3d_cull_points(
+		&poly->vertices[0].position.xyz,
+		&poly->vertices[1].position.xyz,
+		&poly->vertices[2].position.xyz,
+		cam_pos
+	);
 } // polygon3d_cull
 
 #endif // POLYGON3D_H
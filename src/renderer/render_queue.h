@@ -0,0 +1,97 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdlib.h>
+
+#include "../math/mathlib.h"
+
+#include "camera.h"
+#include "entity3d.h"
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+// NOTE: Buckets are drawn in this order. Opaque entities are drawn front to
+//       back so the depth test rejects as much as possible, alpha tested
+//       entities afterwards back to front.
+typedef enum render_queue_bucket_t {
+	RENDER_QUEUE_BUCKET_OPAQUE = 0,
+	RENDER_QUEUE_BUCKET_ALPHA,
+	RENDER_QUEUE_BUCKET_COUNT
+} render_queue_bucket_t;
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+// NOTE: depth is the view depth of the center of the bounding sphere of the
+//       entity, see render_queue_depth. index is the position of the entity
+//       in the entity array, instances follow all entities in batch order.
+//       It breaks ties, so the order is deterministic. cache shares the keys
+//       of the vertex cache of the entity, the frame data is the one of the
+//       entity or for instances a range of the instance vertices of the
+//       renderer.
+typedef struct render_queue_item_t {
+	render_entity3d_t* entity;
+	// Instance drawn with the mesh of entity, NULL for the entity itself
+	render_instance3d_t* instance;
+	vertex_cache3d_t cache;
+	frustum_test_t frustum_test;
+	render_queue_bucket_t bucket;
+	f32 depth;
+	i32 index;
+} render_queue_item_t;
+
+// NOTE: Rebuilt every frame from the entities that survive culling
+typedef struct render_queue_t {
+	i32 count;
+	i32 capacity;
+	render_queue_item_t* items;
+} render_queue_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+// NOTE: The depth of the center is used instead of the nearest point of
+//       the sphere. Large entities around the camera like the ground or a
+//       sky dome all reach behind it, so the nearest point would tie them
+//       at the near plane and draw them before everything else.
+static inline f32 render_queue_depth(point3d_t* center) {
+	return center->z;
+} // render_queue_depth
+
+static inline void render_queue_clear(render_queue_t* queue) {
+	queue->count = 0;
+} // render_queue_clear
+
+static inline void render_queue_push(render_queue_t* queue,
+	render_queue_item_t* item)
+{
+	if (queue->count == queue->capacity) {
+		i32 capacity = queue->capacity ? queue->capacity * 2 : 16;
+		queue->items = realloc(queue->items, sizeof *queue->items * capacity);
+		queue->capacity = capacity;
+	}
+	queue->items[queue->count++] = *item;
+} // render_queue_push
+
+static inline int render_queue_compare(const void* a, const void* b) {
+	const render_queue_item_t* x = a;
+	const render_queue_item_t* y = b;
+	if (x->bucket != y->bucket) return x->bucket < y->bucket ? -1 : 1;
+	if (x->depth != y->depth) {
+		i32 nearer = x->depth < y->depth ? -1 : 1;
+		return x->bucket == RENDER_QUEUE_BUCKET_OPAQUE ? nearer : -nearer;
+	}
+	return x->index - y->index;
+} // render_queue_compare
+
+static inline void render_queue_sort(render_queue_t* queue) {
+	qsort(queue->items, queue->count, sizeof *queue->items,
+		render_queue_compare);
+} // render_queue_sort
+
+static inline void render_queue_free(render_queue_t* queue) {
+	free(queue->items);
+	queue->items = NULL;
+	queue->count = 0;
+	queue->capacity = 0;
+} // render_queue_free
+
+#endif // RENDER_QUEUE_H
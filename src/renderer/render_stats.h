@@ -0,0 +1,94 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <string.h>
+
+#include "../math/mathlib.h"
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+// NOTE: The counters are only compiled in with RENDERER_STATS defined,
+//       otherwise render_stats_add only evaluates the stats pointer and the
+//       count expression is dropped
+#ifdef RENDERER_STATS
+	#define render_stats_add(stats, counter, count) do { \
+		if (stats) (stats)->counters[counter] += (count); \
+	} while (0)
+#else
+	#define render_stats_add(stats, counter, count) ((void) (stats))
+#endif
+
+// Bytes between the counters of two threads so they never share a cache line
+#define RENDER_STATS_THREAD_PADDING 64
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+// NOTE: Every face is either rejected, backfacing or emits triangles;
+//       clipped faces are also counted as such. A tested pixel passed the
+//       coverage test and is either depth rejected, alpha rejected or
+//       written. Written pixels of the visibility buffer mode are shaded
+//       later if they stay visible.
+typedef enum render_stats_counter_t {
+	RENDER_STATS_ENTITIES = 0,
+	RENDER_STATS_ENTITIES_CULLED,
+	RENDER_STATS_FACES,
+	RENDER_STATS_FACES_REJECTED,
+	RENDER_STATS_FACES_BACKFACING,
+	RENDER_STATS_FACES_CLIPPED,
+	RENDER_STATS_TRIANGLES,
+	// Triangles drawn per tile, a triangle covering two tiles counts twice
+	RENDER_STATS_TILE_TRIANGLES,
+	RENDER_STATS_PIXELS_TESTED,
+	RENDER_STATS_PIXELS_DEPTH_REJECTED,
+	RENDER_STATS_PIXELS_ALPHA_REJECTED,
+	RENDER_STATS_PIXELS_WRITTEN,
+	// Pixels that were textured and lit
+	RENDER_STATS_PIXELS_SHADED,
+	RENDER_STATS_COUNTER_COUNT
+} render_stats_counter_t;
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+typedef struct render_stats_t {
+	u64 counters[RENDER_STATS_COUNTER_COUNT];
+} render_stats_t;
+
+typedef struct render_stats_thread_t {
+	render_stats_t stats;
+	u8 padding[RENDER_STATS_THREAD_PADDING];
+} render_stats_thread_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+static inline const char* render_stats_counter_name(
+	render_stats_counter_t counter)
+{
+	static const char* names[RENDER_STATS_COUNTER_COUNT] = {
+		"entities",
+		"entities_culled",
+		"faces",
+		"faces_rejected",
+		"faces_backfacing",
+		"faces_clipped",
+		"triangles",
+		"tile_triangles",
+		"pixels_tested",
+		"pixels_depth_rejected",
+		"pixels_alpha_rejected",
+		"pixels_written",
+		"pixels_shaded"
+	};
+	return names[counter];
+} // render_stats_counter_name
+
+static inline void render_stats_clear(render_stats_t* stats) {
+	memset(stats, 0, sizeof *stats);
+} // render_stats_clear
+
+static inline void render_stats_merge(render_stats_t* out, render_stats_t* in)
+{
+	for (i32 i = 0; i < RENDER_STATS_COUNTER_COUNT; i++)
+		out->counters[i] += in->counters[i];
+} // render_stats_merge
+
+#endif // RENDER_STATS_H
@@ -12,16 +12,96 @@
 #include "material3d.h"
 #include "texture.h"
 #include "polygon3d.h"
+#include "render_queue.h"
+#include "render_stats.h"
+#include "thread_pool.h"
+#include "tile_bins.h"
 
 // D E F I N E S ///////////////////////////////////////////////////////////////
 
 #define RENDERER_ATTRIBUTE_WIREFRAME_BIT 0x0001
 #define RENDERER_ATTRIBUTE_SHADED_BIT 0x0002
+// Draws the original n-gon faces instead of the triangle index buffer
+#define RENDERER_ATTRIBUTE_POLYGONS_BIT 0x0004
+
+#define RENDERER_CLEAR_DEPTH 1000.0f
+
+// NOTE: thread_count 0 selects the serial renderer, any other value the
+//       tile binned renderer with that many threads
+#define RENDERER_THREAD_COUNT_SERIAL 0
+#define RENDERER_THREAD_COUNT_AUTO -1
+
+// Number of cached vertices processed by one job of the tiled renderer
+#define RENDERER_VERTEX_BATCH_SIZE 1024
+
+// Frame packets of the tiled renderer, one is binned by the geometry stage
+// while the pipelined renderer rasterizes the other one
+#define RENDERER_PACKET_COUNT 2
+
+// Half extent of the guard band around the screen in pixels, polygons
+// inside of it are not clipped against the side planes
+#define RENDERER_GUARD_BAND_SIZE 4096
+// The near plane is projected z >= epsilon * w, which keeps the divide in
+// vertex3d_project_to_screen finite
+#define RENDERER_CLIP_NEAR_EPSILON (1.0f / 1024.0f)
+// Outcode bits of the planes that clip, see renderer_clip_plane_t
+#define RENDERER_CLIP_CODE_CLIP_MASK \
+	((1 << RENDERER_CLIP_PLANE_CLIP_COUNT) - 1)
+
+// Clipping adds at most one vertex per plane
+#define RENDERER_CLIP_VERTEX_COUNT_MAX(index_count) \
+	((index_count) + RENDERER_CLIP_PLANE_CLIP_COUNT)
+// Upper bound of triangles emitted for a polygon with index_count indices
+#define RENDERER_POLYGON_TRIANGLE_COUNT_MAX(index_count) \
+	RENDERER_CLIP_VERTEX_COUNT_MAX(index_count)
+
+// Triangle setups kept by the shading pass of the visibility buffer mode,
+// has to be a power of two
+#define RENDERER_SHADE_CACHE_SIZE 16
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+// NOTE: Clip space planes in the order of the outcode bits. Only the first
+//       RENDERER_CLIP_PLANE_CLIP_COUNT planes clip, the screen planes only
+//       reject polygons that lie completely outside of one of them.
+typedef enum renderer_clip_plane_t {
+	RENDERER_CLIP_PLANE_NEAR = 0,
+	RENDERER_CLIP_PLANE_FAR,
+	RENDERER_CLIP_PLANE_GUARD_LEFT,
+	RENDERER_CLIP_PLANE_GUARD_RIGHT,
+	RENDERER_CLIP_PLANE_GUARD_BOTTOM,
+	RENDERER_CLIP_PLANE_GUARD_TOP,
+	RENDERER_CLIP_PLANE_CLIP_COUNT,
+	RENDERER_CLIP_PLANE_SCREEN_LEFT = RENDERER_CLIP_PLANE_CLIP_COUNT,
+	RENDERER_CLIP_PLANE_SCREEN_RIGHT,
+	RENDERER_CLIP_PLANE_SCREEN_BOTTOM,
+	RENDERER_CLIP_PLANE_SCREEN_TOP,
+	RENDERER_CLIP_PLANE_COUNT
+} renderer_clip_plane_t;
 
 // S T R U C T S ///////////////////////////////////////////////////////////////
 
+// NOTE: Triangles of the tile a thread rasterizes in the visibility buffer
+//       mode, the visibility buffer holds indices into it
+typedef struct render_visibility_list_t {
+	u32 count;
+	u32 capacity;
+	triangle3d_t** triangles;
+} render_visibility_list_t;
+
+typedef struct render_shade_entry_t {
+	u32 id;
+	i32 block_index;
+	triangle3d_raster_t raster;
+} render_shade_entry_t;
+
 typedef struct renderer_t {
 	u32 attributes;
+	raster_mode_t raster_mode;
+	i32 thread_count;
+	// Overlaps the geometry of a frame with the raster of the previous one,
+	// only used by the tiled renderer, see renderer_draw_pipelined
+	i32 pipelined;
 	color_rgba_t clear_color;
 	color_rgba_t ambient_light;
 	directional_light_t directional_light;
@@ -29,223 +109,953 @@ typedef struct renderer_t {
 	camera_t camera;
 	i32 entity_count;
 	render_entity3d_t* entities;
+	i32 instance_batch_count;
+	render_instance_batch3d_t* instance_batches;
 	texture_t* textures;
 	material3d_t* materials;
 	color_rgba_t wireframe_color;
 	matrix4x4_t projection_matrix;
+	vector4d_t clip_planes[RENDERER_CLIP_PLANE_COUNT];
+	// Shared by all renderers of the process, see thread_pool_acquire
+	thread_pool_t* thread_pool;
+	tile_bins_t tile_bins[RENDERER_PACKET_COUNT];
+	i32 geometry_packet;
+	i32 raster_packet;
+	// 1 if the raster packet holds a frame that was not rasterized yet
+	i32 packet_pending;
+	i32 vertex_batch_count;
+	i32 vertex_batch_capacity;
+	struct render_batch_t* vertex_batches;
+	// NOTE: Counters of the last frame, merged from thread_stats at its
+	//       end. Always zero unless compiled with RENDERER_STATS.
+	render_stats_t stats;
+	render_stats_thread_t* thread_stats;
+	render_visibility_list_t* visibility_lists;
+	render_queue_t queue;
+	// NOTE: Frame data of the vertex caches of the visible instances, count
+	//       is the number of vertices in use, see renderer_build_queue
+	vertex_cache3d_t instance_vertices;
+	u32 instance_vertex_capacity;
 } renderer_t;
 
+typedef struct render_batch_t {
+	render_queue_item_t* item;
+	u32 begin;
+	u32 end;
+} render_batch_t;
+
+// NOTE: transform and tint are the ones of the entity or of the instance
+//       being drawn, cache holds its vertices
+typedef struct render_entity_state_t {
+	matrix4x4_t rotation_matrix;
+	matrix4x4_t scale_matrix;
+	transform4d_t* transform;
+	color_rgba_t tint;
+	vertex_cache3d_t* cache;
+	texture_t* texture;
+	frustum_test_t frustum_test;
+	// Sort key of the render queue, set by render_entity_cull
+	f32 depth;
+	render_stats_t* stats;
+} render_entity_state_t;
+
 // F U N C T I O N S ///////////////////////////////////////////////////////////
 
-static inline void render_entity_draw(renderer_t* renderer,
-	render_entity3d_t* entity)
+// Threads of the renderer for other work like loading, NULL if serial
+static inline thread_pool_t* renderer_thread_pool(renderer_t* renderer) {
+	if (renderer->thread_count == RENDERER_THREAD_COUNT_SERIAL) return NULL;
+	return renderer->thread_pool;
+} // renderer_thread_pool
+
+// Counters of the thread with the given index, NULL without RENDERER_STATS
+static inline render_stats_t* renderer_thread_stats(renderer_t* renderer,
+	i32 thread_index)
 {
+#ifdef RENDERER_STATS
+	return &renderer->thread_stats[thread_index].stats;
+#else
+	(void) renderer;
+	(void) thread_index;
+	return NULL;
+#endif
+} // renderer_thread_stats
+
+static inline void renderer_stats_begin(renderer_t* renderer) {
+#ifdef RENDERER_STATS
+	i32 thread_count = renderer->thread_count > 1 ? renderer->thread_count : 1;
+	for (i32 i = 0; i < thread_count; i++)
+		render_stats_clear(&renderer->thread_stats[i].stats);
+#else
+	(void) renderer;
+#endif
+} // renderer_stats_begin
+
+static inline void renderer_stats_end(renderer_t* renderer) {
+#ifdef RENDERER_STATS
+	i32 thread_count = renderer->thread_count > 1 ? renderer->thread_count : 1;
+	render_stats_clear(&renderer->stats);
+	for (i32 i = 0; i < thread_count; i++)
+		render_stats_merge(&renderer->stats, &renderer->thread_stats[i].stats);
+#else
+	(void) renderer;
+#endif
+} // renderer_stats_end
+
+// Clip space planes as coefficients of (x, y, z, w), see
+// renderer_clip_plane_t. The divisor of x and y is the projected z.
+static inline void renderer_create_clip_planes(renderer_t* renderer) {
 	framebuffer_t* fb = &renderer->framebuffer;
-	camera_t* camera = &renderer->camera;
+	f32 guard_x = 1.0f + 2.0f * RENDERER_GUARD_BAND_SIZE / fb->width;
+	f32 guard_y = 1.0f + 2.0f * RENDERER_GUARD_BAND_SIZE / fb->height;
+
+	vector4d_t* p = renderer->clip_planes;
+	p[RENDERER_CLIP_PLANE_NEAR] =
+		(vector4d_t) {{ 0.0f, 0.0f, 1.0f, -RENDERER_CLIP_NEAR_EPSILON }};
+	p[RENDERER_CLIP_PLANE_FAR] = (vector4d_t) {{ 0.0f, 0.0f, -1.0f, 1.0f }};
+	p[RENDERER_CLIP_PLANE_GUARD_LEFT] =
+		(vector4d_t) {{ 1.0f, 0.0f, guard_x, 0.0f }};
+	p[RENDERER_CLIP_PLANE_GUARD_RIGHT] =
+		(vector4d_t) {{ -1.0f, 0.0f, guard_x, 0.0f }};
+	p[RENDERER_CLIP_PLANE_GUARD_BOTTOM] =
+		(vector4d_t) {{ 0.0f, 1.0f, guard_y, 0.0f }};
+	p[RENDERER_CLIP_PLANE_GUARD_TOP] =
+		(vector4d_t) {{ 0.0f, -1.0f, guard_y, 0.0f }};
+	p[RENDERER_CLIP_PLANE_SCREEN_LEFT] =
+		(vector4d_t) {{ 1.0f, 0.0f, 1.0f, 0.0f }};
+	p[RENDERER_CLIP_PLANE_SCREEN_RIGHT] =
+		(vector4d_t) {{ -1.0f, 0.0f, 1.0f, 0.0f }};
+	p[RENDERER_CLIP_PLANE_SCREEN_BOTTOM] =
+		(vector4d_t) {{ 0.0f, 1.0f, 1.0f, 0.0f }};
+	p[RENDERER_CLIP_PLANE_SCREEN_TOP] =
+		(vector4d_t) {{ 0.0f, -1.0f, 1.0f, 0.0f }};
+} // renderer_create_clip_planes
 
-	vector4d_t* translation = &entity->transform.position;
-	vector4d_t* rotation = &entity->transform.rotation;
-	vector4d_t* scale = &entity->transform.scale;
+// Outcode of a clip space position, bit i is set if it is outside of plane i
+static inline u16 renderer_clip_code(renderer_t* renderer, point4d_t* p) {
+	u16 code = 0;
+	for (i32 i = 0; i < RENDERER_CLIP_PLANE_COUNT; i++) {
+		f32 dot = vector4d_dot_product(p, &renderer->clip_planes[i]);
+		if (!(dot >= 0.0f)) code |= 1 << i;
+	}
+	return code;
+} // renderer_clip_code
+
+// Starts drawing the entity, or instance of it if that is not NULL.
+// thread_index selects the counters of the calling thread.
+static inline void render_entity_begin(renderer_t* renderer,
+	render_entity3d_t* entity, render_instance3d_t* instance,
+	render_entity_state_t* state, i32 thread_index)
+{
+	state->transform = instance ? &instance->transform : &entity->transform;
+	state->tint = instance ? instance->tint :
+		color_rgba(1.0f, 1.0f, 1.0f, 1.0f);
+	state->cache = &entity->vertex_cache;
+	vector4d_t* rotation = &state->transform->rotation;
+	vector4d_t* scale = &state->transform->scale;
 
-	matrix4x4_t rotation_matrix = matrix4x4_identity;
-	matrix4x4_t scale_matrix = matrix4x4_identity;
+	state->rotation_matrix = matrix4x4_identity;
+	state->scale_matrix = matrix4x4_identity;
 	render_entity3d_create_rotation_matrix(
-		&rotation_matrix,
+		&state->rotation_matrix,
 		rotation
 	);
 	render_entity3d_create_scale_matrix(
-		&scale_matrix,
-		scale
-	);
-
-	matrix4x4_t rotation_matrix_inverse = matrix4x4_identity;
-	matrix4x4_t scale_matrix_inverse = matrix4x4_identity;
-	matrix4x4_transpose(&rotation_matrix_inverse, &rotation_matrix);
-	render_entity3d_create_inverse_scale_matrix(
-		&scale_matrix_inverse,
+		&state->scale_matrix,
 		scale
 	);
 
 	u32 material_index = entity->material_index;
 	u32 texture_index = renderer->materials[material_index].texture_index;
+	state->texture = &renderer->textures[texture_index];
+	state->frustum_test = FRUSTUM_TEST_INTERSECTING;
+	state->depth = 0.0f;
+	state->stats = renderer_thread_stats(renderer, thread_index);
+} // render_entity_begin
 
-	for (u32 i = 0; i < entity->face_count; i++) {
-		// Setup polygon
-		face3d_t* face = &entity->faces[i];
-		color_rgba_t color = color_rgba(
-			1.0f, 1.0f, 1.0f, 1.0f
-		);
-		u32 index_count = face->index_count;
-		vertex3d_t local_coords[index_count];
-		polygon3d_t poly_local = polygon3d(index_count, local_coords);
-		for (u32 j = 0; j < index_count; j++) {
-			local_coords[j].position = entity->vertices[
-				face->indices[j].position
-			];
-			local_coords[j].texcoord = entity->texcoords[
-				face->indices[j].texcoord
-			];
-			local_coords[j].normal = entity->normals[
-				face->indices[j].normal
-			];
-			local_coords[j].color = color;
-		}
+// Transforms a local space position of the entity to camera space, exactly
+// like render_entity_process_vertices does
+static inline void render_entity_transform_point(renderer_t* renderer,
+	render_entity_state_t* state, point4d_t* out, point4d_t* in)
+{
+	point4d_t world_r, world_rs, world_rst;
+	vector4d_multiply_matrix4x4(&world_r, in, &state->rotation_matrix);
+	vector4d_multiply_matrix4x4(&world_rs, &world_r, &state->scale_matrix);
+	vector4d_add(&world_rst, &world_rs, &state->transform->position);
+	vector4d_multiply_matrix4x4(out, &world_rst, &renderer->camera.matrix);
+} // render_entity_transform_point
 
-		// Transform local -> world
-		vertex3d_t world_coords_r[index_count];
-		vertex3d_t world_coords_rs[index_count];
-		vertex3d_t world_coords_rst[index_count];
-		polygon3d_t poly_world_r = polygon3d(
-			index_count,
-			world_coords_r
-		);
-		polygon3d_t poly_world_rs = polygon3d(
-			index_count,
-			world_coords_rs
-		);
-		polygon3d_t poly_world_rst = polygon3d(
-			index_count,
-			world_coords_rst
-		);
-		polygon3d_transform(
-			&poly_world_r,
-			&poly_local,
-			&rotation_matrix
-		);
-		polygon3d_transform(
-			&poly_world_rs,
-			&poly_world_r,
-			&scale_matrix
-		);
-		polygon3d_translate(
-			&poly_world_rst,
-			&poly_world_rs,
-			translation
+// Tests the bounds of the entity against the view frustum, first the
+// bounding sphere and if that is not conclusive the corners of the box.
+// Has to be called after render_entity_begin.
+static inline void render_entity_cull(renderer_t* renderer,
+	render_entity3d_t* entity, render_entity_state_t* state)
+{
+	camera_t* camera = &renderer->camera;
+	point4d_t* b_min = &entity->bounds_min;
+	point4d_t* b_max = &entity->bounds_max;
+
+	point4d_t center = point4d(
+		(b_min->x + b_max->x) * 0.5f,
+		(b_min->y + b_max->y) * 0.5f,
+		(b_min->z + b_max->z) * 0.5f
+	);
+	point4d_t center_camera;
+	render_entity_transform_point(renderer, state, &center_camera, &center);
+	vector4d_t* scale = &state->transform->scale;
+	f32 scale_max = absolute(scale->x);
+	if (absolute(scale->y) > scale_max) scale_max = absolute(scale->y);
+	if (absolute(scale->z) > scale_max) scale_max = absolute(scale->z);
+
+	render_stats_add(state->stats, RENDER_STATS_ENTITIES, 1);
+	state->depth = render_queue_depth(&center_camera.xyz);
+	state->frustum_test = camera_test_sphere(camera, &center_camera.xyz,
+		entity->bounds_radius * scale_max);
+	if (state->frustum_test == FRUSTUM_TEST_OUTSIDE)
+		render_stats_add(state->stats, RENDER_STATS_ENTITIES_CULLED, 1);
+	if (state->frustum_test != FRUSTUM_TEST_INTERSECTING) return;
+
+	point4d_t corners[8];
+	for (i32 i = 0; i < 8; i++) {
+		point4d_t corner = point4d(
+			(i & 1) ? b_max->x : b_min->x,
+			(i & 2) ? b_max->y : b_min->y,
+			(i & 4) ? b_max->z : b_min->z
 		);
+		render_entity_transform_point(renderer, state, &corners[i], &corner);
+	}
+	state->frustum_test = camera_test_points(camera, corners, 8);
+	if (state->frustum_test == FRUSTUM_TEST_OUTSIDE)
+		render_stats_add(state->stats, RENDER_STATS_ENTITIES_CULLED, 1);
+} // render_entity_cull
 
-		for (u32 j = 0; j < index_count; j++) {
-			vertex3d_t* vertex = &world_coords_rst[j];
-			vector3d_t n = vertex->normal.xyz;
-			vector3d_negate(&n, &n);
-			vector3d_normalize(&n, &n);
-			vector3d_t dlight_direction;
-			vector3d_normalize(
-				&dlight_direction,
-				&renderer->directional_light.direction.xyz
-			);
+static inline void render_entity_light_vertex(renderer_t* renderer,
+	vertex3d_t* vertex)
+{
+	vector3d_t n = vertex->normal.xyz;
+	vector3d_negate(&n, &n);
+	vector3d_normalize(&n, &n);
+	vector3d_t dlight_direction;
+	vector3d_normalize(
+		&dlight_direction,
+		&renderer->directional_light.direction.xyz
+	);
 
-			f32 intensity = vector3d_dot_product(
-				&dlight_direction,
-				&n
-			);
-			intensity = clamp(intensity, 0.0f, 1.0f);
+	f32 intensity = vector3d_dot_product(
+		&dlight_direction,
+		&n
+	);
+	intensity = clamp(intensity, 0.0f, 1.0f);
 
-			color_rgba_t diffuse;
-			vector3d_multiply_float(
-				&diffuse.rgb,
-				&renderer->directional_light.diffuse.rgb,
-				intensity
-			);
+	color_rgba_t diffuse;
+	vector3d_multiply_float(
+		&diffuse.rgb,
+		&renderer->directional_light.diffuse.rgb,
+		intensity
+	);
 
-			color_rgba_t ambient_light;
-			vector3d_add(
-				&ambient_light.rgb,
-				&renderer->ambient_light.rgb,
-				&diffuse.rgb
-			);
-			vector3d_multiply(
-				&vertex->color.rgb,
-				&vertex->color.rgb,
-				&ambient_light.rgb
-			);
-			vector4d_clamp(
-				&vertex->color.rgba,
-				&vertex->color.rgba,
-				0.0f, 1.0f
-			);
-		}
+	color_rgba_t ambient_light;
+	vector3d_add(
+		&ambient_light.rgb,
+		&renderer->ambient_light.rgb,
+		&diffuse.rgb
+	);
+	vector3d_multiply(
+		&vertex->color.rgb,
+		&vertex->color.rgb,
+		&ambient_light.rgb
+	);
+	vector4d_clamp(
+		&vertex->color.rgba,
+		&vertex->color.rgba,
+		0.0f, 1.0f
+	);
+} // render_entity_light_vertex
 
-		// Transform world -> camera
-		vertex3d_t camera_coords[index_count];
-		polygon3d_t poly_camera = polygon3d(index_count, camera_coords);
-		polygon3d_transform(
-			&poly_camera,
-			&poly_world_rst,
-			&camera->matrix
-		);
+// Transforms and lights the cached vertices [begin, end) of the entity into
+// camera space, computes their clip space outcodes and projects them to the
+// screen. Has to run before render_entity_draw_polygon each frame. The
+// outcodes are zero if the whole entity is inside of the frustum.
+static inline void render_entity_process_vertices(renderer_t* renderer,
+	render_entity3d_t* entity, render_entity_state_t* state,
+	u32 begin, u32 end)
+{
+	framebuffer_t* fb = &renderer->framebuffer;
+	camera_t* camera = &renderer->camera;
+	vertex_cache3d_t* cache = state->cache;
+	vector4d_t* translation = &state->transform->position;
 
-		// Backface culling
-		point3d_t cam_pos = point3d(0.0f, 0.0f, 0.0f);
-		if (polygon3d_cull(&poly_camera, &cam_pos)) continue;
-
-		// Polygon Clipping
-		vertex3d_t clip_coords[CLIPPING_PLANES_COUNT][index_count * 2];
-		i32 clip_coords_count = triangle3d_clip(
-			clip_coords[0],
-			camera_coords,
-			&camera->clipping_planes[0],
-			index_count
+	for (u32 i = begin; i < end; i++) {
+		index3d_t* key = &cache->keys[i];
+		vertex3d_t local = vertex3d(
+			entity->vertices[key->position],
+			entity->texcoords[key->texcoord],
+			entity->normals[key->normal],
+			state->tint
 		);
-		for (i32 j = 1; j < CLIPPING_PLANES_COUNT; j++) {
-			clip_coords_count = triangle3d_clip(
-				clip_coords[j],
-				clip_coords[j-1],
-				&camera->clipping_planes[j],
-				clip_coords_count
+
+		// Transform local -> world
+		vertex3d_t world_r, world_rs, world_rst;
+		vertex3d_transform(&world_r, &local, &state->rotation_matrix);
+		vertex3d_transform(&world_rs, &world_r, &state->scale_matrix);
+		vertex3d_translate(&world_rst, &world_rs, translation);
+
+		render_entity_light_vertex(renderer, &world_rst);
+
+		// Transform world -> camera
+		vertex3d_t* camera_vertex = &cache->camera[i];
+		vertex3d_transform(camera_vertex, &world_rst, &camera->matrix);
+
+		// Transform camera -> projected -> screen
+		vertex3d_t projected;
+		vertex3d_transform(&projected, camera_vertex,
+			&renderer->projection_matrix);
+		cache->clip_codes[i] = (state->frustum_test == FRUSTUM_TEST_INSIDE) ?
+			0 : renderer_clip_code(renderer, &projected.position);
+
+		vertex3d_t* screen_vertex = &cache->screen[i];
+		vertex3d_project_to_screen(&screen_vertex->position,
+			&projected.position, fb->width, fb->height);
+		screen_vertex->texcoord = projected.texcoord;
+		screen_vertex->normal = projected.normal;
+		screen_vertex->color = projected.color;
+	}
+} // render_entity_process_vertices
+
+// Culls and clips one polygon given by indices into the vertex cache of
+// the state and writes the resulting screen space triangles to out, which
+// has to hold at least RENDERER_POLYGON_TRIANGLE_COUNT_MAX(index_count)
+// triangles. Returns the number of triangles written.
+static inline i32 render_entity_draw_polygon(renderer_t* renderer,
+	render_entity_state_t* state, u32 index_count, u32* cache_indices,
+	triangle3d_t* out)
+{
+	framebuffer_t* fb = &renderer->framebuffer;
+	vertex_cache3d_t* cache = state->cache;
+	render_stats_add(state->stats, RENDER_STATS_FACES, 1);
+
+	// Trivial reject if all vertices are outside of the same plane
+	u16 code_and = 0xFFFF;
+	u16 code_or = 0;
+	for (u32 j = 0; j < index_count; j++) {
+		u16 code = cache->clip_codes[cache_indices[j]];
+		code_and &= code;
+		code_or |= code;
+	}
+	if (code_and) {
+		render_stats_add(state->stats, RENDER_STATS_FACES_REJECTED, 1);
+		return 0;
+	}
+
+	// Backface culling
+	point3d_t cam_pos = point3d(0.0f, 0.0f, 0.0f);
+	if (polygon3d_cull_points(
+		&cache->camera[cache_indices[0]].position.xyz,
+		&cache->camera[cache_indices[1]].position.xyz,
+		&cache->camera[cache_indices[2]].position.xyz,
+		&cam_pos
+	)) {
+		render_stats_add(state->stats, RENDER_STATS_FACES_BACKFACING, 1);
+		return 0;
+	}
+
+	// Trivial accept, the polygon is inside of the guard band and between
+	// the near and far plane so the cached screen vertices can be used
+	if (!(code_or & RENDERER_CLIP_CODE_CLIP_MASK)) {
+		for (u32 j = 1; j < index_count - 1; j++) {
+			out[j - 1] = triangle3d(
+				cache->screen[cache_indices[0]],
+				cache->screen[cache_indices[j]],
+				cache->screen[cache_indices[j+1]],
+				state->texture
 			);
 		}
-		
-		if (clip_coords_count < 3) continue;
-		
-		polygon3d_t poly_clipped = polygon3d(
-			clip_coords_count,
-			clip_coords[CLIPPING_PLANES_COUNT - 1]
-		);
-		
-		// Transform clipped -> projected
-		vertex3d_t projected_coords[clip_coords_count];
-		polygon3d_t poly_projected = polygon3d(
-			clip_coords_count,
-			projected_coords
-		);
-		polygon3d_transform(
-			&poly_projected,
-			&poly_clipped,
-			&renderer->projection_matrix
-		);
+		render_stats_add(state->stats, RENDER_STATS_TRIANGLES,
+			index_count - 2);
+		return index_count - 2;
+	}
 
-		// Transform projected -> screen
-		vertex3d_t screen_coords[clip_coords_count];
-		polygon3d_t poly_screen = polygon3d(
-			clip_coords_count,
-			screen_coords
-		);
-		polygon3d_project_to_screen(
-			&poly_screen,
-			&poly_projected,
-			fb->width,
-			fb->height
+	// Polygon Clipping, in clip space against the crossed planes only
+	render_stats_add(state->stats, RENDER_STATS_FACES_CLIPPED, 1);
+	vertex3d_t clip_coords[2][RENDERER_CLIP_VERTEX_COUNT_MAX(index_count)];
+	vertex3d_t* in = clip_coords[0];
+	vertex3d_t* clipped = clip_coords[1];
+	for (u32 j = 0; j < index_count; j++) {
+		vertex3d_transform(&in[j], &cache->camera[cache_indices[j]],
+			&renderer->projection_matrix);
+	}
+	i32 clip_coords_count = index_count;
+	for (i32 j = 0; j < RENDERER_CLIP_PLANE_CLIP_COUNT; j++) {
+		if (!(code_or & (1 << j))) continue;
+		clip_coords_count = triangle3d_clip(clipped, in,
+			&renderer->clip_planes[j], clip_coords_count);
+		vertex3d_t* temp = in;
+		in = clipped;
+		clipped = temp;
+	}
+
+	if (clip_coords_count < 3) return 0;
+
+	// Transform clipped -> screen
+	polygon3d_t poly_clipped = polygon3d(clip_coords_count, in);
+	vertex3d_t screen_coords[clip_coords_count];
+	polygon3d_t poly_screen = polygon3d(
+		clip_coords_count,
+		screen_coords
+	);
+	polygon3d_project_to_screen(
+		&poly_screen,
+		&poly_clipped,
+		fb->width,
+		fb->height
+	);
+
+	// Setup triangles
+	for (i32 j = 1; j < clip_coords_count - 1; j++) {
+		out[j - 1] = triangle3d(
+			screen_coords[0],
+			screen_coords[j],
+			screen_coords[j+1],
+			state->texture
 		);
+	}
 
-		// Setup and draw triangles
-		for (i32 j = 0; j < clip_coords_count - 1; j++) {
-			triangle3d_t triangle = triangle3d(
-				screen_coords[0],
-				screen_coords[j],
-				screen_coords[j+1],
-				&renderer->textures[texture_index]
-			);
+	render_stats_add(state->stats, RENDER_STATS_TRIANGLES,
+		clip_coords_count - 2);
+	return clip_coords_count - 2;
+} // render_entity_draw_polygon
+
+static inline u32 render_entity_primitive_count(renderer_t* renderer,
+	render_entity3d_t* entity)
+{
+	if (renderer->attributes & RENDERER_ATTRIBUTE_POLYGONS_BIT)
+		return entity->face_count;
+	return entity->triangle_count;
+} // render_entity_primitive_count
 
-			triangle3d_fill(fb, &triangle);
+static inline u32 render_entity_primitive_index_count(renderer_t* renderer,
+	render_entity3d_t* entity, u32 primitive)
+{
+	if (renderer->attributes & RENDERER_ATTRIBUTE_POLYGONS_BIT)
+		return entity->faces[primitive].index_count;
+	return 3;
+} // render_entity_primitive_index_count
+
+// Draws triangle i of the index buffer of the entity, or face i with
+// RENDERER_ATTRIBUTE_POLYGONS_BIT, see render_entity_draw_polygon
+static inline i32 render_entity_draw_primitive(renderer_t* renderer,
+	render_entity3d_t* entity, render_entity_state_t* state, u32 primitive,
+	triangle3d_t* out)
+{
+	if (renderer->attributes & RENDERER_ATTRIBUTE_POLYGONS_BIT) {
+		face3d_t* face = &entity->faces[primitive];
+		return render_entity_draw_polygon(renderer, state,
+			face->index_count, face->cache_indices, out);
+	}
+	return render_entity_draw_polygon(renderer, state,
+		3, &entity->triangle_indices[primitive * 3], out);
+} // render_entity_draw_primitive
+
+static inline void renderer_fill_rect(renderer_t* renderer,
+	triangle3d_t* triangle, i32 x_min, i32 y_min, i32 x_max, i32 y_max,
+	render_stats_t* stats)
+{
+	framebuffer_t* fb = &renderer->framebuffer;
+	render_stats_add(stats, RENDER_STATS_TILE_TRIANGLES, 1);
+	switch (renderer->raster_mode) {
+		case RASTER_MODE_EDGE:
+		case RASTER_MODE_VISIBILITY:
+			triangle3d_fill_edge_rect(fb, triangle,
+				x_min, y_min, x_max, y_max, stats);
+			break;
+		case RASTER_MODE_SCANLINE:
+		default:
+			triangle3d_fill_rect(fb, triangle,
+				x_min, y_min, x_max, y_max, stats);
+			break;
+	}
+} // renderer_fill_rect
+
+// Starts drawing a queued entity or instance with its vertices
+static inline void render_entity_begin_item(renderer_t* renderer,
+	render_queue_item_t* item, render_entity_state_t* state,
+	i32 thread_index)
+{
+	render_entity_begin(renderer, item->entity, item->instance, state,
+		thread_index);
+	state->frustum_test = item->frustum_test;
+	state->cache = &item->cache;
+} // render_entity_begin_item
+
+static inline void render_entity_draw(renderer_t* renderer,
+	render_queue_item_t* item)
+{
+	framebuffer_t* fb = &renderer->framebuffer;
+	render_entity3d_t* entity = item->entity;
+	render_entity_state_t state;
+	render_entity_begin_item(renderer, item, &state, 0);
+	render_entity_process_vertices(renderer, entity, &state,
+		0, item->cache.count);
+
+	u32 primitive_count = render_entity_primitive_count(renderer, entity);
+	for (u32 i = 0; i < primitive_count; i++) {
+		u32 index_count = render_entity_primitive_index_count(renderer,
+			entity, i);
+		triangle3d_t triangles[
+			RENDERER_POLYGON_TRIANGLE_COUNT_MAX(index_count)
+		];
+		i32 triangle_count = render_entity_draw_primitive(renderer, entity,
+			&state, i, triangles);
+
+		for (i32 j = 0; j < triangle_count; j++) {
+			triangle3d_setup(&triangles[j]);
+			renderer_fill_rect(renderer, &triangles[j],
+				0, 0, fb->width, fb->height, state.stats);
 			i32 wireframe = renderer->attributes &
 				RENDERER_ATTRIBUTE_WIREFRAME_BIT;
 			if (wireframe) {
-				triangle3d_stroke(fb, &triangle);
+				triangle3d_stroke(fb, &triangles[j]);
 			}
 		}
 	}
 } // render_entity_draw
 
+static inline void renderer_vertex_job(void* data, i32 index,
+	i32 thread_index)
+{
+	renderer_t* renderer = data;
+	render_batch_t* batch = &renderer->vertex_batches[index];
+
+	render_entity_state_t state;
+	render_entity_begin_item(renderer, batch->item, &state, thread_index);
+	render_entity_process_vertices(renderer, batch->item->entity, &state,
+		batch->begin, batch->end);
+} // renderer_vertex_job
+
+static inline void renderer_push_vertex_batch(renderer_t* renderer,
+	render_queue_item_t* item, u32 begin, u32 end)
+{
+	if (renderer->vertex_batch_count == renderer->vertex_batch_capacity) {
+		i32 capacity = renderer->vertex_batch_capacity ?
+			renderer->vertex_batch_capacity * 2 : 16;
+		renderer->vertex_batches = realloc(renderer->vertex_batches,
+			sizeof *renderer->vertex_batches * capacity);
+		renderer->vertex_batch_capacity = capacity;
+	}
+	render_batch_t* batch =
+		&renderer->vertex_batches[renderer->vertex_batch_count++];
+	batch->item = item;
+	batch->begin = begin;
+	batch->end = end;
+} // renderer_push_vertex_batch
+
+static inline void renderer_geometry_job(void* data, i32 index,
+	i32 thread_index)
+{
+	renderer_t* renderer = data;
+	tile_bins_t* bins = &renderer->tile_bins[renderer->geometry_packet];
+	tile_chunk_t* chunk = &bins->chunks[index];
+	render_entity3d_t* entity = chunk->item->entity;
+
+	render_entity_state_t state;
+	render_entity_begin_item(renderer, chunk->item, &state, thread_index);
+
+	chunk->triangle_count = 0;
+	for (u32 i = chunk->begin; i < chunk->end; i++) {
+		u32 index_count = render_entity_primitive_index_count(renderer,
+			entity, i);
+		triangle3d_t* triangles = tile_chunk_reserve(chunk,
+			RENDERER_POLYGON_TRIANGLE_COUNT_MAX(index_count));
+		i32 triangle_count = render_entity_draw_primitive(renderer, entity,
+			&state, i, triangles);
+		for (i32 j = 0; j < triangle_count; j++)
+			triangle3d_setup(&triangles[j]);
+		chunk->triangle_count += triangle_count;
+	}
+
+	tile_chunk_bin(chunk, bins);
+} // renderer_geometry_job
+
+static inline void renderer_visibility_list_push(
+	render_visibility_list_t* list, triangle3d_t* triangle)
+{
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 256;
+		list->triangles = realloc(list->triangles,
+			sizeof *list->triangles * list->capacity);
+	}
+	list->triangles[list->count++] = triangle;
+} // renderer_visibility_list_push
+
+// Shading pass of the visibility buffer mode over a rectangle of whole
+// depth blocks. Runs of pixels with the same triangle are shaded together;
+// the mip level is selected per block at its center like in the color pass,
+// so the result is bit-identical to RASTER_MODE_EDGE.
+static inline void renderer_shade_rect(renderer_t* renderer,
+	render_visibility_list_t* list, i32 x_min, i32 y_min, i32 x_max,
+	i32 y_max, render_stats_t* stats)
+{
+	framebuffer_t* fb = &renderer->framebuffer;
+	const i32 bs = FRAMEBUFFER_DEPTH_BLOCK_SIZE;
+	u32 clear = color_to_u32(&renderer->clear_color, fb->image_format);
+
+	render_shade_entry_t cache[RENDERER_SHADE_CACHE_SIZE];
+	for (i32 i = 0; i < RENDERER_SHADE_CACHE_SIZE; i++)
+		cache[i].id = FRAMEBUFFER_VISIBILITY_NONE;
+
+	for (i32 y = y_min; y < y_max; y++) {
+		for (i32 x = x_min; x < x_max;) {
+			i32 block_x = x / bs;
+			i32 row_offset = framebuffer_row_offset(fb, block_x * bs, y);
+			f32* depth_row = &fb->depth[row_offset];
+			u32* color_row = &fb->color[row_offset];
+			u32* id_row = &fb->visibility[row_offset];
+			u32 id = id_row[x];
+			i32 run_end = min((block_x + 1) * bs, x_max);
+			i32 end = x + 1;
+			while (end < run_end && id_row[end] == id) end++;
+
+			if (id == FRAMEBUFFER_VISIBILITY_NONE) {
+				for (; x < end; x++) color_row[x] = clear;
+				continue;
+			}
+
+			render_shade_entry_t* entry =
+				&cache[id & (RENDERER_SHADE_CACHE_SIZE - 1)];
+			if (entry->id != id) {
+				entry->id = id;
+				entry->block_index = -1;
+				triangle3d_raster_setup(&entry->raster, fb,
+					list->triangles[id]);
+				entry->raster.stats = stats;
+			}
+			triangle3d_raster_t* raster = &entry->raster;
+			i32 block_index = (y / bs) * fb->depth_blocks_x + block_x;
+			if (raster->texture.level_count > 1 &&
+				entry->block_index != block_index)
+			{
+				entry->block_index = block_index;
+				triangle3d_raster_select_level(raster,
+					block_x * bs + bs * 0.5f, (y / bs) * bs + bs * 0.5f);
+			}
+
+#ifdef TRIANGLE3D_SSE2
+			triangle3d_raster_shade_span_sse2(raster, depth_row, color_row,
+				x, end, y + 0.5f);
+#else
+			triangle3d_raster_shade_span(raster, depth_row, color_row,
+				x, end, y + 0.5f);
+#endif
+			x = end;
+		}
+	}
+} // renderer_shade_rect
+
+// Visibility buffer mode of renderer_raster_job
+static inline void renderer_raster_visibility(renderer_t* renderer,
+	i32 index, i32 x_min, i32 y_min, i32 x_max, i32 y_max, i32 thread_index)
+{
+	framebuffer_t* fb = &renderer->framebuffer;
+	tile_bins_t* bins = &renderer->tile_bins[renderer->raster_packet];
+	render_stats_t* stats = renderer_thread_stats(renderer, thread_index);
+	render_visibility_list_t* list = &renderer->visibility_lists[thread_index];
+
+	clear_visibility_rect(fb, RENDERER_CLEAR_DEPTH,
+		x_min, y_min, x_max, y_max);
+
+	list->count = 0;
+	for (i32 i = 0; i < bins->chunk_count; i++) {
+		tile_chunk_t* chunk = &bins->chunks[i];
+		u32 begin = chunk->bin_offsets[index];
+		u32 end = chunk->bin_offsets[index + 1];
+		for (u32 j = begin; j < end; j++) {
+			triangle3d_t* triangle =
+				&chunk->triangles[chunk->bin_entries[j]];
+			render_stats_add(stats, RENDER_STATS_TILE_TRIANGLES, 1);
+			triangle3d_fill_visibility_rect(fb, triangle,
+				x_min, y_min, x_max, y_max, list->count, stats);
+			renderer_visibility_list_push(list, triangle);
+		}
+	}
+
+	renderer_shade_rect(renderer, list, x_min, y_min, x_max, y_max, stats);
+
+	if (renderer->attributes & RENDERER_ATTRIBUTE_WIREFRAME_BIT) {
+		for (u32 i = 0; i < list->count; i++) {
+			triangle3d_stroke_rect(fb, list->triangles[i],
+				x_min, y_min, x_max, y_max);
+		}
+	}
+} // renderer_raster_visibility
+
+static inline void renderer_raster_job(void* data, i32 index,
+	i32 thread_index)
+{
+	renderer_t* renderer = data;
+	framebuffer_t* fb = &renderer->framebuffer;
+	tile_bins_t* bins = &renderer->tile_bins[renderer->raster_packet];
+	render_stats_t* stats = renderer_thread_stats(renderer, thread_index);
+
+	i32 x_min = (index % bins->tiles_x) * TILE_SIZE;
+	i32 y_min = (index / bins->tiles_x) * TILE_SIZE;
+	i32 x_max = min(x_min + TILE_SIZE, fb->width);
+	i32 y_max = min(y_min + TILE_SIZE, fb->height);
+
+	// NOTE: Tiles without triangles are only filled at present time
+	u32 triangle_count = 0;
+	for (i32 i = 0; i < bins->chunk_count; i++) {
+		tile_chunk_t* chunk = &bins->chunks[i];
+		triangle_count += chunk->bin_offsets[index + 1] -
+			chunk->bin_offsets[index];
+	}
+	if (triangle_count == 0) {
+		clear_rect_lazy(fb, x_min, y_min, x_max, y_max);
+		return;
+	}
+
+	if (renderer->raster_mode == RASTER_MODE_VISIBILITY) {
+		renderer_raster_visibility(renderer, index, x_min, y_min,
+			x_max, y_max, thread_index);
+		return;
+	}
+
+	clear_rect(fb, &renderer->clear_color, RENDERER_CLEAR_DEPTH,
+		x_min, y_min, x_max, y_max);
+
+	i32 wireframe = renderer->attributes & RENDERER_ATTRIBUTE_WIREFRAME_BIT;
+	for (i32 i = 0; i < bins->chunk_count; i++) {
+		tile_chunk_t* chunk = &bins->chunks[i];
+		u32 begin = chunk->bin_offsets[index];
+		u32 end = chunk->bin_offsets[index + 1];
+		for (u32 j = begin; j < end; j++) {
+			triangle3d_t* triangle =
+				&chunk->triangles[chunk->bin_entries[j]];
+			renderer_fill_rect(renderer, triangle,
+				x_min, y_min, x_max, y_max, stats);
+			if (wireframe) {
+				triangle3d_stroke_rect(fb, triangle,
+					x_min, y_min, x_max, y_max);
+			}
+		}
+	}
+} // renderer_raster_job
+
+static inline render_queue_bucket_t renderer_entity_bucket(
+	renderer_t* renderer, render_entity3d_t* entity)
+{
+	u32 texture_index =
+		renderer->materials[entity->material_index].texture_index;
+	texture_t* texture = &renderer->textures[texture_index];
+	return texture->alpha_min < TRIANGLE3D_ALPHA_REF ?
+		RENDER_QUEUE_BUCKET_ALPHA : RENDER_QUEUE_BUCKET_OPAQUE;
+} // renderer_entity_bucket
+
+// Culls the entity, or instance of it if that is not NULL, against its
+// bounds and queues it if it is visible
+static inline void renderer_queue_entity(renderer_t* renderer,
+	render_entity3d_t* entity, render_instance3d_t* instance,
+	render_queue_bucket_t bucket, i32 index)
+{
+	render_entity_state_t state;
+	render_entity_begin(renderer, entity, instance, &state, 0);
+	render_entity_cull(renderer, entity, &state);
+	if (state.frustum_test == FRUSTUM_TEST_OUTSIDE) return;
+
+	render_queue_item_t item;
+	item.entity = entity;
+	item.instance = instance;
+	item.cache = entity->vertex_cache;
+	item.frustum_test = state.frustum_test;
+	item.bucket = bucket;
+	item.depth = state.depth;
+	item.index = index;
+	render_queue_push(&renderer->queue, &item);
+} // renderer_queue_entity
+
+// Points the vertex caches of the queued instances at their own range of
+// the instance vertices, entities keep writing to their own cache
+static inline void renderer_alloc_instance_vertices(renderer_t* renderer) {
+	render_queue_t* queue = &renderer->queue;
+	vertex_cache3d_t* vertices = &renderer->instance_vertices;
+
+	u32 count = 0;
+	for (i32 i = 0; i < queue->count; i++) {
+		if (queue->items[i].instance)
+			count += queue->items[i].cache.count;
+	}
+	if (count > renderer->instance_vertex_capacity) {
+		u32 capacity = renderer->instance_vertex_capacity * 2;
+		if (capacity < count) capacity = count;
+		vertex_cache3d_free_frame_data(vertices);
+		vertices->count = capacity;
+		vertex_cache3d_alloc_frame_data(vertices);
+		renderer->instance_vertex_capacity = capacity;
+	}
+	vertices->count = count;
+
+	u32 offset = 0;
+	for (i32 i = 0; i < queue->count; i++) {
+		render_queue_item_t* item = &queue->items[i];
+		if (!item->instance) continue;
+		item->cache.camera = &vertices->camera[offset];
+		item->cache.screen = &vertices->screen[offset];
+		item->cache.clip_codes = &vertices->clip_codes[offset];
+		offset += item->cache.count;
+	}
+} // renderer_alloc_instance_vertices
+
+// Culls the entities and instances and queues the visible ones in drawing
+// order. The material of an instance batch is resolved once for all of its
+// instances.
+static inline void renderer_build_queue(renderer_t* renderer) {
+	render_queue_clear(&renderer->queue);
+	for (i32 i = 0; i < renderer->entity_count; i++) {
+		render_entity3d_t* entity = &renderer->entities[i];
+		renderer_queue_entity(renderer, entity, NULL,
+			renderer_entity_bucket(renderer, entity), i);
+	}
+
+	i32 index = renderer->entity_count;
+	for (i32 i = 0; i < renderer->instance_batch_count; i++) {
+		render_instance_batch3d_t* batch = &renderer->instance_batches[i];
+		render_queue_bucket_t bucket = renderer_entity_bucket(renderer,
+			batch->entity);
+		for (u32 j = 0; j < batch->instance_count; j++) {
+			renderer_queue_entity(renderer, batch->entity,
+				&batch->instances[j], bucket, index++);
+		}
+	}
+
+	renderer_alloc_instance_vertices(renderer);
+	render_queue_sort(&renderer->queue);
+} // renderer_build_queue
+
+// Splits the queued entities into the vertex batches and primitive chunks of
+// the geometry stage, the chunks are pushed to the geometry packet
+static inline void renderer_build_jobs(renderer_t* renderer) {
+	framebuffer_t* fb = &renderer->framebuffer;
+	tile_bins_t* bins = &renderer->tile_bins[renderer->geometry_packet];
+
+	tile_bins_resize(bins, fb);
+	bins->chunk_count = 0;
+	renderer->vertex_batch_count = 0;
+	for (i32 i = 0; i < renderer->queue.count; i++) {
+		render_queue_item_t* item = &renderer->queue.items[i];
+		render_entity3d_t* entity = item->entity;
+
+		u32 vertex_count = item->cache.count;
+		for (u32 j = 0; j < vertex_count; j += RENDERER_VERTEX_BATCH_SIZE) {
+			renderer_push_vertex_batch(renderer, item, j,
+				min(j + RENDERER_VERTEX_BATCH_SIZE, vertex_count));
+		}
+		u32 primitive_count = render_entity_primitive_count(renderer,
+			entity);
+		for (u32 j = 0; j < primitive_count;
+			j += TILE_CHUNK_PRIMITIVE_COUNT)
+		{
+			tile_chunk_t* chunk = tile_bins_push_chunk(bins);
+			chunk->item = item;
+			chunk->begin = j;
+			chunk->end = min(j + TILE_CHUNK_PRIMITIVE_COUNT,
+				primitive_count);
+		}
+	}
+} // renderer_build_jobs
+
+// Sets the color of the lazily cleared tiles, called before a raster stage
+// is submitted so its jobs only read it
+static inline void renderer_set_clear_value(renderer_t* renderer) {
+	framebuffer_t* fb = &renderer->framebuffer;
+	fb->clear_value = color_to_u32(&renderer->clear_color, fb->image_format);
+} // renderer_set_clear_value
+
+// Sort-middle renderer: the vertices and then the faces of all entities are
+// processed in parallel chunks, the triangles are binned into screen tiles
+// and every tile is rasterized by exactly one thread. The result is
+// bit-identical to the serial renderer. Also used by the serial renderer in
+// the visibility buffer mode, then all jobs run on the calling thread.
+// The stages are chained through counters and submitted at once.
+static inline void renderer_draw_tiled(renderer_t* renderer) {
+	thread_pool_t* pool = renderer_thread_pool(renderer);
+
+	renderer->raster_packet = renderer->geometry_packet;
+	renderer->packet_pending = 0;
+	renderer_build_jobs(renderer);
+	renderer_set_clear_value(renderer);
+
+	tile_bins_t* bins = &renderer->tile_bins[renderer->geometry_packet];
+	thread_pool_counter_t vertices = { 0 };
+	thread_pool_counter_t geometry = { 0 };
+	thread_pool_counter_t raster = { 0 };
+	thread_pool_submit(pool, renderer->vertex_batch_count,
+		renderer_vertex_job, renderer, NULL, &vertices);
+	thread_pool_submit(pool, bins->chunk_count, renderer_geometry_job,
+		renderer, &vertices, &geometry);
+	thread_pool_submit(pool, bins->tiles_x * bins->tiles_y,
+		renderer_raster_job, renderer, &geometry, &raster);
+	thread_pool_wait(pool, &raster);
+} // renderer_draw_tiled
+
+// Pipelined variant of renderer_draw_tiled. The geometry stage bins the
+// current frame into one packet while the raster stage draws the packet of
+// the previous frame. Only the geometry waits for the vertices, so threads
+// done with one stage keep working on the other one instead of waiting at a
+// barrier. The framebuffer holds the previous frame on return, one frame of
+// latency; renderer_flush rasterizes the last one. Stats of a frame count
+// its geometry and the raster of the previous frame.
+static inline void renderer_draw_pipelined(renderer_t* renderer) {
+	framebuffer_t* fb = &renderer->framebuffer;
+	thread_pool_t* pool = renderer_thread_pool(renderer);
+
+	// NOTE: A packet binned for another framebuffer size is dropped, the
+	//       framebuffer is cleared in its place like for the first frame
+	tile_bins_t* pending = &renderer->tile_bins[renderer->raster_packet];
+	if (renderer->packet_pending &&
+		(pending->width != fb->width || pending->height != fb->height))
+	{
+		renderer->packet_pending = 0;
+	}
+	if (!renderer->packet_pending)
+		clear_color_depth(fb, &renderer->clear_color, RENDERER_CLEAR_DEPTH);
+
+	renderer->geometry_packet = renderer->raster_packet ^ 1;
+	renderer_build_jobs(renderer);
+
+	tile_bins_t* bins = &renderer->tile_bins[renderer->geometry_packet];
+	i32 tile_count = renderer->packet_pending ?
+		pending->tiles_x * pending->tiles_y : 0;
+	thread_pool_counter_t raster = { 0 };
+	thread_pool_counter_t vertices = { 0 };
+	thread_pool_counter_t geometry = { 0 };
+	renderer_set_clear_value(renderer);
+	thread_pool_submit(pool, tile_count, renderer_raster_job, renderer,
+		NULL, &raster);
+	thread_pool_submit(pool, renderer->vertex_batch_count,
+		renderer_vertex_job, renderer, NULL, &vertices);
+	thread_pool_submit(pool, bins->chunk_count, renderer_geometry_job,
+		renderer, &vertices, &geometry);
+	thread_pool_wait(pool, &raster);
+	thread_pool_wait(pool, &geometry);
+
+	renderer->raster_packet = renderer->geometry_packet;
+	renderer->packet_pending = 1;
+} // renderer_draw_pipelined
+
+// Rasterizes the frame the pipelined renderer still holds back, e.g. before
+// reading the framebuffer for the last time
+static inline void renderer_flush(renderer_t* renderer) {
+	framebuffer_t* fb = &renderer->framebuffer;
+	tile_bins_t* bins = &renderer->tile_bins[renderer->raster_packet];
+	if (!renderer->packet_pending) return;
+	renderer->packet_pending = 0;
+	if (bins->width != fb->width || bins->height != fb->height) return;
+
+	renderer_stats_begin(renderer);
+	renderer_set_clear_value(renderer);
+	thread_pool_run(renderer_thread_pool(renderer),
+		bins->tiles_x * bins->tiles_y, renderer_raster_job, renderer);
+	renderer_stats_end(renderer);
+} // renderer_flush
+
 static inline void renderer_init(renderer_t* renderer) {
 	framebuffer_t* fb = &renderer->framebuffer;
 
@@ -253,23 +1063,78 @@ static inline void renderer_init(renderer_t* renderer) {
 	renderer->projection_matrix = matrix4x4_identity;
 	matrix4x4_projection(&renderer->projection_matrix, camera->z_near,
 		camera->z_far, camera->fov, fb->width, fb->height);
+
+	if (renderer->thread_count == RENDERER_THREAD_COUNT_AUTO)
+		renderer->thread_count = thread_pool_cpu_count();
+	if (renderer->thread_count != RENDERER_THREAD_COUNT_SERIAL) {
+		renderer->thread_pool = thread_pool_acquire(renderer->thread_count);
+		renderer->thread_count = renderer->thread_pool->thread_count;
+	}
+
+	i32 thread_count = renderer->thread_count > 1 ? renderer->thread_count : 1;
+	renderer->visibility_lists = calloc(thread_count,
+		sizeof *renderer->visibility_lists);
+
+	render_stats_clear(&renderer->stats);
+#ifdef RENDERER_STATS
+	renderer->thread_stats = calloc(thread_count,
+		sizeof *renderer->thread_stats);
+#endif
 } // renderer_init
 
+static inline void renderer_shut(renderer_t* renderer) {
+	i32 thread_count = renderer->thread_count > 1 ? renderer->thread_count : 1;
+	for (i32 i = 0; i < thread_count; i++)
+		free(renderer->visibility_lists[i].triangles);
+	free(renderer->visibility_lists);
+	renderer->visibility_lists = NULL;
+
+	if (renderer->thread_count != RENDERER_THREAD_COUNT_SERIAL)
+		thread_pool_release(renderer->thread_pool);
+	renderer->thread_pool = NULL;
+	for (i32 i = 0; i < RENDERER_PACKET_COUNT; i++)
+		tile_bins_free(&renderer->tile_bins[i]);
+	renderer->packet_pending = 0;
+	render_queue_free(&renderer->queue);
+	vertex_cache3d_free_frame_data(&renderer->instance_vertices);
+	renderer->instance_vertices.count = 0;
+	renderer->instance_vertex_capacity = 0;
+	free(renderer->vertex_batches);
+	renderer->vertex_batches = NULL;
+	renderer->vertex_batch_count = 0;
+	renderer->vertex_batch_capacity = 0;
+	free(renderer->thread_stats);
+	renderer->thread_stats = NULL;
+} // renderer_shut
+
 static inline void renderer_loop(renderer_t* renderer) {
 	framebuffer_t* fb = &renderer->framebuffer;
 
-	clear_color(fb, &renderer->clear_color);
-	clear_depth(fb, 1000.0f);
-
 	camera_t* camera = &renderer->camera;
 	camera_create_euler_matrix(&camera->matrix, camera);
-	camera_create_clipping_planes(camera, fb);
+	camera_create_clipping_planes(camera, &renderer->projection_matrix);
+	renderer_create_clip_planes(renderer);
+	renderer_stats_begin(renderer);
+	renderer_build_queue(renderer);
 
-	for (i32 i = 0; i < renderer->entity_count; i++) {
-		render_entity3d_t* entity = &renderer->entities[i];
+	if (renderer->raster_mode == RASTER_MODE_VISIBILITY)
+		framebuffer_require_visibility(fb);
+
+	i32 tiled = renderer->thread_count != RENDERER_THREAD_COUNT_SERIAL ||
+		renderer->raster_mode == RASTER_MODE_VISIBILITY;
+	if (tiled && renderer->pipelined) {
+		renderer_draw_pipelined(renderer);
+	} else if (tiled) {
+		renderer_draw_tiled(renderer);
+	} else {
+		renderer->packet_pending = 0;
+		clear_color_depth(fb, &renderer->clear_color, RENDERER_CLEAR_DEPTH);
 
-		render_entity_draw(renderer, entity);
+		for (i32 i = 0; i < renderer->queue.count; i++)
+			render_entity_draw(renderer, &renderer->queue.items[i]);
 	}
+
+	renderer_stats_end(renderer);
 } // renderer_loop
 
 #endif // RENDERER_H
@@ -13,9 +13,14 @@
 #include "line3d.h"
 #include "material3d.h"
 #include "polygon3d.h"
+#include "render_queue.h"
+#include "render_stats.h"
 #include "renderer.h"
 #include "texture.h"
+#include "thread_pool.h"
+#include "tile_bins.h"
 #include "triangle3d.h"
 #include "vertex3d.h"
+#include "vertex_cache3d.h"
 
 #endif // RENDERLIB_H
@@ -1,6 +1,8 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <stdlib.h>
+
 #include "../math/mathlib.h"
 
 #include "color_rgba.h"
@@ -10,24 +12,239 @@
 #define texture(width, height, data) (texture_t) { \
 	(i32) (width), \
 	(i32) (height), \
-	(color_rgba_t *) (data) \
+	(u32 *) (data) \
 }
 
+#define TEXTURE_LEVEL_COUNT_MAX 16
+
+// NOTE: Texels are packed as 0xAARRGGBB, the channels are bytes
+#define texel_argb(r, g, b, a) ( \
+	(u32) (a) << 24 | \
+	(u32) (r) << 16 | \
+	(u32) (g) << 8 | \
+	(u32) (b) \
+)
+#define texel_a(texel) ((texel) >> 24)
+#define texel_r(texel) (((texel) >> 16) & 0xFF)
+#define texel_g(texel) (((texel) >> 8) & 0xFF)
+#define texel_b(texel) ((texel) & 0xFF)
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+typedef enum texture_address_t {
+	TEXTURE_ADDRESS_WRAP = 0,
+	TEXTURE_ADDRESS_CLAMP
+} texture_address_t;
+
+// NOTE: All filters sample the mip level selected by the rasterizer,
+//       TEXTURE_FILTER_TRILINEAR also blends with the next smaller level
+typedef enum texture_filter_t {
+	TEXTURE_FILTER_NEAREST = 0,
+	TEXTURE_FILTER_BILINEAR,
+	TEXTURE_FILTER_TRILINEAR
+} texture_filter_t;
+
 // S T R U C T S ///////////////////////////////////////////////////////////////
 
+// NOTE: width_shift is log2(width) if width and height are both powers of
+//       two and -1 otherwise, see texture_set_address. levels[0] is data,
+//       the smaller levels are built by texture_build_mipmaps. alpha_min
+//       is the lowest alpha of all texels or 0 if unknown, see
+//       texture_update_alpha_min.
 typedef struct texture_t {
 	i32 width;
 	i32 height;
-	color_rgba_t* data;
+	u32* data;
+	texture_address_t address;
+	i32 width_shift;
+	i32 width_mask;
+	i32 height_mask;
+	texture_filter_t filter;
+	i32 level_count;
+	u32** levels;
+	u32 alpha_min;
 } texture_t;
 
 // F U N C T I O N S ///////////////////////////////////////////////////////////
 
+static inline i32 texture_log2(i32 n) {
+	if (n <= 0 || (n & (n - 1))) return -1;
+	i32 shift = 0;
+	while ((1 << shift) < n) shift++;
+	return shift;
+} // texture_log2
+
+// Sets the address mode and derives the masks used by texture_texel_index,
+// has to be called whenever the size of the texture changes
+static inline void texture_set_address(texture_t* tex,
+	texture_address_t address)
+{
+	tex->address = address;
+	tex->width_shift = -1;
+	tex->width_mask = tex->width - 1;
+	tex->height_mask = tex->height - 1;
+	if (texture_log2(tex->height) >= 0)
+		tex->width_shift = texture_log2(tex->width);
+} // texture_set_address
+
+// Index of texel (tu, tv) after wrapping or clamping
+static inline i32 texture_texel_index(texture_t* tex, i32 tu, i32 tv) {
+	if (tex->address == TEXTURE_ADDRESS_CLAMP) {
+		tu = (tu < 0) ? 0 : (tu > tex->width_mask) ? tex->width_mask : tu;
+		tv = (tv < 0) ? 0 : (tv > tex->height_mask) ? tex->height_mask : tv;
+	} else if (tex->width_shift >= 0) {
+		return (tv & tex->height_mask) << tex->width_shift |
+			(tu & tex->width_mask);
+	} else {
+		tu %= tex->width;
+		tv %= tex->height;
+		if (tu < 0) tu += tex->width;
+		if (tv < 0) tv += tex->height;
+	}
+	return tv * tex->width + tu;
+} // texture_texel_index
+
+// Linear approximation of log2 from the float bits, exact at powers of two
+static inline f32 texture_log2_approx(f32 x) {
+	union { f32 f; u32 i; } bits = { x };
+	return (f32) bits.i * (1.0f / (1 << 23)) - 127.0f;
+} // texture_log2_approx
+
+// Blends two texels channel wise, weight is in [0, 256]
+static inline u32 texture_lerp_texel(u32 a, u32 b, u32 weight) {
+	u32 inverse = 256 - weight;
+	u32 rb = (((a & 0xFF00FF) * inverse + (b & 0xFF00FF) * weight) >> 8) &
+		0xFF00FF;
+	u32 ag = (((a >> 8) & 0xFF00FF) * inverse +
+		((b >> 8) & 0xFF00FF) * weight) & 0xFF00FF00;
+	return rb | ag;
+} // texture_lerp_texel
+
+// View of one mip level that can be sampled like a texture of its own
+static inline void texture_level(texture_t* out, texture_t* tex, i32 level) {
+	*out = *tex;
+	if (level <= 0 || tex->level_count <= 1) return;
+	if (level >= tex->level_count) level = tex->level_count - 1;
+
+	out->width = tex->width >> level;
+	out->height = tex->height >> level;
+	if (out->width < 1) out->width = 1;
+	if (out->height < 1) out->height = 1;
+	out->data = tex->levels[level];
+	out->width_mask = out->width - 1;
+	out->height_mask = out->height - 1;
+	if (tex->width_shift >= 0) {
+		out->width_shift = (tex->width_shift > level) ?
+			tex->width_shift - level : 0;
+	}
+} // texture_level
+
+// Filtered texels and the texels of smaller levels never have a lower alpha
+// than the lowest alpha of the texels
+static inline void texture_update_alpha_min(texture_t* tex) {
+	u32 alpha_min = 0xFF;
+	for (i32 i = 0; i < tex->width * tex->height; i++) {
+		u32 a = texel_a(tex->data[i]);
+		if (a < alpha_min) alpha_min = a;
+	}
+	tex->alpha_min = alpha_min;
+} // texture_update_alpha_min
+
+// Builds the mip chain down to 1x1 with a 2x2 box filter
+static inline void texture_build_mipmaps(texture_t* tex) {
+	i32 level_count = 1;
+	i32 size = 0;
+	i32 width = tex->width;
+	i32 height = tex->height;
+	while ((width > 1 || height > 1) &&
+		level_count < TEXTURE_LEVEL_COUNT_MAX)
+	{
+		width = (width > 1) ? width >> 1 : 1;
+		height = (height > 1) ? height >> 1 : 1;
+		size += width * height;
+		level_count++;
+	}
+
+	tex->level_count = level_count;
+	tex->levels = malloc(sizeof *tex->levels * level_count);
+	tex->levels[0] = tex->data;
+	u32* level_data = (size > 0) ? malloc(sizeof *level_data * size) : NULL;
+
+	texture_t src = *tex;
+	for (i32 level = 1; level < level_count; level++) {
+		texture_t dst;
+		tex->levels[level] = level_data;
+		texture_level(&dst, tex, level);
+		level_data += dst.width * dst.height;
+
+		for (i32 y = 0; y < dst.height; y++) {
+			u32* row0 = &src.data[(y * 2) * src.width];
+			u32* row1 = &src.data[min(y * 2 + 1, src.height - 1) * src.width];
+			for (i32 x = 0; x < dst.width; x++) {
+				i32 x0 = x * 2;
+				i32 x1 = min(x0 + 1, src.width - 1);
+				u32 t00 = row0[x0], t01 = row0[x1];
+				u32 t10 = row1[x0], t11 = row1[x1];
+				u32 rb = (t00 & 0xFF00FF) + (t01 & 0xFF00FF) +
+					(t10 & 0xFF00FF) + (t11 & 0xFF00FF) + 0x020002;
+				u32 ag = ((t00 >> 8) & 0xFF00FF) + ((t01 >> 8) & 0xFF00FF) +
+					((t10 >> 8) & 0xFF00FF) + ((t11 >> 8) & 0xFF00FF) +
+					0x020002;
+				dst.data[y * dst.width + x] = ((rb >> 2) & 0xFF00FF) |
+					((ag << 6) & 0xFF00FF00);
+			}
+		}
+		src = dst;
+	}
+} // texture_build_mipmaps
+
+static inline void texture_free(texture_t* tex) {
+	if (tex->level_count > 1)
+		free(tex->levels[1]);
+	free(tex->levels);
+	free(tex->data);
+	tex->levels = NULL;
+	tex->data = NULL;
+	tex->level_count = 0;
+} // texture_free
+
+static inline u32 texture_sample_nearest(texture_t* tex, f32 u, f32 v) {
+	return tex->data[texture_texel_index(tex, (i32) u, (i32) v)];
+} // texture_sample_nearest
+
+// u and v are in texels, texel centers are at .5
+static inline u32 texture_sample_bilinear(texture_t* tex, f32 u, f32 v) {
+	f32 x = u - 0.5f;
+	f32 y = v - 0.5f;
+	i32 x0 = (i32) x;
+	i32 y0 = (i32) y;
+	if ((f32) x0 > x) x0--;
+	if ((f32) y0 > y) y0--;
+	u32 wx = (u32) ((x - x0) * 256.0f);
+	u32 wy = (u32) ((y - y0) * 256.0f);
+
+	u32 t00 = tex->data[texture_texel_index(tex, x0, y0)];
+	u32 t01 = tex->data[texture_texel_index(tex, x0 + 1, y0)];
+	u32 t10 = tex->data[texture_texel_index(tex, x0, y0 + 1)];
+	u32 t11 = tex->data[texture_texel_index(tex, x0 + 1, y0 + 1)];
+	return texture_lerp_texel(
+		texture_lerp_texel(t00, t01, wx),
+		texture_lerp_texel(t10, t11, wx),
+		wy
+	);
+} // texture_sample_bilinear
+
+static inline void texture_swap_texels(u32* a, u32* b) {
+	u32 temp = *a;
+	*a = *b;
+	*b = temp;
+} // texture_swap_texels
+
 static inline void texture_flip_horizontal(texture_t* tex) {
 	i32 half_width = tex->width >> 1;
 	for (i32 y = 0; y < tex->height; y++) {
 		for (i32 x = 0; x < half_width; x++) {
-			color_swap(
+			texture_swap_texels(
 				&tex->data[y * tex->width + x],
 				&tex->data[y * tex->width + tex->width - 1 - x]
 			);
@@ -41,7 +258,7 @@ static inline void texture_flip_vertical(texture_t* tex) {
 	i32 bottom_line = size - tex->width;
 	for (i32 y = 0; y < half_height; y++) {
 		for (i32 x = 0; x < tex->width; x++) {
-			color_swap(
+			texture_swap_texels(
 				&tex->data[y * tex->width + x],
 				&tex->data[bottom_line - y * tex->width + x]
 			);
@@ -0,0 +1,457 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../math/mathlib.h"
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+#define THREAD_POOL_THREAD_COUNT_MAX 64
+
+// Initial number of tasks a deque holds, it grows on demand
+#define THREAD_POOL_DEQUE_CAPACITY 64
+
+// NOTE: With THREAD_POOL_DETERMINISTIC defined no worker threads are
+//       started and every job runs on the submitting thread in index order
+//       as thread 0, so a debug build always executes in the same order.
+//       The thread count is still reported, scratch data is sized the same.
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+// NOTE: index is the job index in [0, job_count), thread_index identifies the
+//       executing thread in [0, thread_count) and can be used for scratch data
+typedef void (*thread_pool_job_t)(void* data, i32 index, i32 thread_index);
+
+// NOTE: Number of submitted job indices that did not finish yet. Counters
+//       start at zero, are owned by the submitter and have to outlive the
+//       jobs counted with them.
+typedef struct thread_pool_counter_t {
+	i32 value;
+} thread_pool_counter_t;
+
+// NOTE: A range of job indices. Workers split ranges larger than grain and
+//       leave the upper half to thieves. dependency is NULL or a counter
+//       that has to reach zero before the task may start.
+typedef struct thread_pool_task_t {
+	thread_pool_job_t job;
+	void* data;
+	i32 begin;
+	i32 end;
+	i32 grain;
+	thread_pool_counter_t* dependency;
+	thread_pool_counter_t* counter;
+} thread_pool_task_t;
+
+// NOTE: The owner pushes and pops at the bottom, thieves steal from the top,
+//       which holds the oldest and therefore largest ranges
+typedef struct thread_pool_deque_t {
+	pthread_mutex_t mutex;
+	u32 top;
+	u32 count;
+	u32 capacity;
+	thread_pool_task_t* tasks;
+} thread_pool_deque_t;
+
+struct thread_pool_t;
+
+typedef struct thread_pool_worker_t {
+	struct thread_pool_t* pool;
+	i32 thread_index;
+	pthread_t thread;
+} thread_pool_worker_t;
+
+// NOTE: Work-stealing scheduler. Every worker owns a deque, tasks submitted
+//       from outside go to the shared inbox deque at index thread_count.
+//       Submitting threads do not run jobs of the pool while they wait, so
+//       several of them never put more than thread_count threads to work.
+typedef struct thread_pool_t {
+	i32 thread_count;
+	thread_pool_worker_t* workers;
+	thread_pool_deque_t* deques;
+	// Guards waiting and quit, and the sleeping workers and waiters
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	i32 task_count;
+	i32 sleeping_count;
+	i32 quit;
+	// Tasks whose dependency did not reach zero yet
+	i32 waiting_count;
+	i32 waiting_capacity;
+	thread_pool_task_t* waiting;
+} thread_pool_t;
+
+// G L O B A L   V A R I A B L E S /////////////////////////////////////////////
+
+// NOTE: Process wide pool shared by every thread_pool_acquire, the library
+//       is header only, so this assumes it is compiled into one unit
+static thread_pool_t thread_pool_shared;
+static i32 thread_pool_shared_count = 0;
+static pthread_mutex_t thread_pool_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+static inline i32 thread_pool_cpu_count() {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1) return 1;
+	if (count > THREAD_POOL_THREAD_COUNT_MAX)
+		return THREAD_POOL_THREAD_COUNT_MAX;
+	return (i32) count;
+} // thread_pool_cpu_count
+
+static inline void thread_pool_deque_init(thread_pool_deque_t* deque) {
+	pthread_mutex_init(&deque->mutex, NULL);
+	deque->top = 0;
+	deque->count = 0;
+	deque->capacity = THREAD_POOL_DEQUE_CAPACITY;
+	deque->tasks = malloc(sizeof *deque->tasks * deque->capacity);
+} // thread_pool_deque_init
+
+static inline void thread_pool_deque_free(thread_pool_deque_t* deque) {
+	pthread_mutex_destroy(&deque->mutex);
+	free(deque->tasks);
+	deque->tasks = NULL;
+} // thread_pool_deque_free
+
+static inline void thread_pool_deque_push(thread_pool_deque_t* deque,
+	thread_pool_task_t* task)
+{
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->count == deque->capacity) {
+		// NOTE: The capacity is a power of two, the ring is unrolled
+		u32 capacity = deque->capacity * 2;
+		thread_pool_task_t* tasks = malloc(sizeof *tasks * capacity);
+		for (u32 i = 0; i < deque->count; i++)
+			tasks[i] = deque->tasks[(deque->top + i) & (deque->capacity - 1)];
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->top = 0;
+		deque->capacity = capacity;
+	}
+	u32 bottom = (deque->top + deque->count) & (deque->capacity - 1);
+	deque->tasks[bottom] = *task;
+	deque->count++;
+	pthread_mutex_unlock(&deque->mutex);
+} // thread_pool_deque_push
+
+// Removes the newest task if bottom is set, otherwise the oldest one.
+// Returns 0 if the deque is empty.
+static inline i32 thread_pool_deque_pop(thread_pool_deque_t* deque,
+	i32 bottom, thread_pool_task_t* task)
+{
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->count == 0) {
+		pthread_mutex_unlock(&deque->mutex);
+		return 0;
+	}
+	deque->count--;
+	if (bottom) {
+		*task = deque->tasks[(deque->top + deque->count) &
+			(deque->capacity - 1)];
+	} else {
+		*task = deque->tasks[deque->top];
+		deque->top = (deque->top + 1) & (deque->capacity - 1);
+	}
+	pthread_mutex_unlock(&deque->mutex);
+	return 1;
+} // thread_pool_deque_pop
+
+// Makes a task available to the workers and wakes one if all sleep
+static inline void thread_pool_push(thread_pool_t* pool, i32 deque_index,
+	thread_pool_task_t* task)
+{
+	thread_pool_deque_push(&pool->deques[deque_index], task);
+
+	// NOTE: Sleeping workers register before checking task_count under the
+	//       mutex, with both sequentially consistent one side sees the other
+	__atomic_add_fetch(&pool->task_count, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->sleeping_count, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_signal(&pool->work_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+} // thread_pool_push
+
+// Own deque first, then the inbox and the other workers in a fixed order
+static inline i32 thread_pool_find_task(thread_pool_t* pool,
+	i32 thread_index, thread_pool_task_t* task)
+{
+	i32 deque_count = pool->thread_count + 1;
+	for (i32 i = 0; i < deque_count; i++) {
+		i32 index = (thread_index + i) % deque_count;
+		if (thread_pool_deque_pop(&pool->deques[index], index == thread_index,
+			task))
+		{
+			__atomic_sub_fetch(&pool->task_count, 1, __ATOMIC_SEQ_CST);
+			return 1;
+		}
+	}
+	return 0;
+} // thread_pool_find_task
+
+static inline void thread_pool_enqueue(thread_pool_t* pool,
+	thread_pool_task_t* task);
+
+// Marks count job indices of the counter as done. The last decrement is
+// made under the mutex, so a waiter that sees zero only returns once the
+// counter is not touched anymore and the dependents are released.
+static inline void thread_pool_counter_done(thread_pool_t* pool,
+	thread_pool_counter_t* counter, i32 count)
+{
+	i32 value = __atomic_load_n(&counter->value, __ATOMIC_ACQUIRE);
+	while (value != count) {
+		if (__atomic_compare_exchange_n(&counter->value, &value,
+			value - count, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	__atomic_sub_fetch(&counter->value, count, __ATOMIC_ACQ_REL);
+
+	i32 released_count = 0;
+	thread_pool_task_t* released = NULL;
+	for (i32 i = 0; i < pool->waiting_count;) {
+		if (pool->waiting[i].dependency != counter) {
+			i++;
+			continue;
+		}
+		released = realloc(released, sizeof *released * (released_count + 1));
+		released[released_count++] = pool->waiting[i];
+		pool->waiting[i] = pool->waiting[--pool->waiting_count];
+	}
+
+	pthread_cond_broadcast(&pool->done_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i32 i = 0; i < released_count; i++) {
+		released[i].dependency = NULL;
+		thread_pool_enqueue(pool, &released[i]);
+	}
+	free(released);
+} // thread_pool_counter_done
+
+// Runs a task on the given thread. Halves are split off the end of the
+// range and pushed to the own deque until the rest is at most grain large.
+static inline void thread_pool_execute(thread_pool_t* pool,
+	i32 thread_index, thread_pool_task_t* task)
+{
+	thread_pool_task_t run = *task;
+	while (run.end - run.begin > run.grain) {
+		thread_pool_task_t upper = run;
+		upper.begin = run.begin + (run.end - run.begin) / 2;
+		run.end = upper.begin;
+		thread_pool_push(pool, thread_index, &upper);
+	}
+
+	for (i32 i = run.begin; i < run.end; i++)
+		run.job(run.data, i, thread_index);
+
+	if (run.counter)
+		thread_pool_counter_done(pool, run.counter, run.end - run.begin);
+} // thread_pool_execute
+
+// Queues a task whose dependency is satisfied
+static inline void thread_pool_enqueue(thread_pool_t* pool,
+	thread_pool_task_t* task)
+{
+	thread_pool_push(pool, pool->thread_count, task);
+} // thread_pool_enqueue
+
+static inline void* thread_pool_worker_main(void* arg) {
+	thread_pool_worker_t* worker = arg;
+	thread_pool_t* pool = worker->pool;
+
+	for (;;) {
+		thread_pool_task_t task;
+		if (thread_pool_find_task(pool, worker->thread_index, &task)) {
+			thread_pool_execute(pool, worker->thread_index, &task);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		__atomic_add_fetch(&pool->sleeping_count, 1, __ATOMIC_SEQ_CST);
+		while (!pool->quit &&
+			__atomic_load_n(&pool->task_count, __ATOMIC_SEQ_CST) <= 0)
+		{
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		}
+		__atomic_sub_fetch(&pool->sleeping_count, 1, __ATOMIC_SEQ_CST);
+		i32 quit = pool->quit;
+		pthread_mutex_unlock(&pool->mutex);
+		if (quit) break;
+	}
+
+	return NULL;
+} // thread_pool_worker_main
+
+// NOTE: Starts thread_count workers, one per thread index
+static inline void thread_pool_init(thread_pool_t* pool, i32 thread_count) {
+	if (thread_count < 1) thread_count = 1;
+	if (thread_count > THREAD_POOL_THREAD_COUNT_MAX)
+		thread_count = THREAD_POOL_THREAD_COUNT_MAX;
+
+	pool->thread_count = thread_count;
+	pool->task_count = 0;
+	pool->sleeping_count = 0;
+	pool->quit = 0;
+	pool->waiting_count = 0;
+	pool->waiting_capacity = 0;
+	pool->waiting = NULL;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	pool->deques = malloc(sizeof *pool->deques * (thread_count + 1));
+	for (i32 i = 0; i <= thread_count; i++)
+		thread_pool_deque_init(&pool->deques[i]);
+
+	pool->workers = malloc(sizeof *pool->workers * thread_count);
+#ifndef THREAD_POOL_DETERMINISTIC
+	// NOTE: A single thread runs the jobs inline, see thread_pool_submit
+	if (thread_count == 1) return;
+	for (i32 i = 0; i < thread_count; i++) {
+		thread_pool_worker_t* worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->thread_index = i;
+		pthread_create(&worker->thread, NULL, thread_pool_worker_main,
+			worker);
+	}
+#endif
+} // thread_pool_init
+
+static inline void thread_pool_shut(thread_pool_t* pool) {
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+#ifndef THREAD_POOL_DETERMINISTIC
+	if (pool->thread_count > 1) {
+		for (i32 i = 0; i < pool->thread_count; i++)
+			pthread_join(pool->workers[i].thread, NULL);
+	}
+#endif
+
+	for (i32 i = 0; i <= pool->thread_count; i++)
+		thread_pool_deque_free(&pool->deques[i]);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool->waiting);
+	pool->deques = NULL;
+	pool->workers = NULL;
+	pool->waiting = NULL;
+	pool->thread_count = 0;
+} // thread_pool_shut
+
+// Returns the process wide pool, started with thread_count threads by the
+// first caller. Later callers share it whatever count they ask for, so
+// several renderers never start more threads than the first one did.
+static inline thread_pool_t* thread_pool_acquire(i32 thread_count) {
+	pthread_mutex_lock(&thread_pool_shared_mutex);
+	if (thread_pool_shared_count++ == 0)
+		thread_pool_init(&thread_pool_shared, thread_count);
+	pthread_mutex_unlock(&thread_pool_shared_mutex);
+	return &thread_pool_shared;
+} // thread_pool_acquire
+
+// The last release stops the threads of the shared pool
+static inline void thread_pool_release(thread_pool_t* pool) {
+	pthread_mutex_lock(&thread_pool_shared_mutex);
+	if (--thread_pool_shared_count == 0)
+		thread_pool_shut(pool);
+	pthread_mutex_unlock(&thread_pool_shared_mutex);
+} // thread_pool_release
+
+// Parallel for over [0, job_count) that starts once dependency reached zero
+// and adds job_count to counter until the jobs are done; both may be NULL.
+// Ranges are split down to grain indices. Jobs must not wait themselves,
+// they chain through dependencies instead. Without threads, pool NULL or
+// THREAD_POOL_DETERMINISTIC, all jobs run on the calling thread right away
+// and dependencies are done already since everything before ran that way.
+static inline void thread_pool_submit_grain(thread_pool_t* pool,
+	i32 job_count, i32 grain, thread_pool_job_t job, void* data,
+	thread_pool_counter_t* dependency, thread_pool_counter_t* counter)
+{
+	if (job_count <= 0) return;
+#ifdef THREAD_POOL_DETERMINISTIC
+	if (1) {
+#else
+	if (pool == NULL || pool->thread_count <= 1) {
+#endif
+		for (i32 i = 0; i < job_count; i++)
+			job(data, i, 0);
+		return;
+	}
+
+	thread_pool_task_t task;
+	task.job = job;
+	task.data = data;
+	task.begin = 0;
+	task.end = job_count;
+	task.grain = grain > 0 ? grain : 1;
+	task.dependency = dependency;
+	task.counter = counter;
+	if (counter)
+		__atomic_add_fetch(&counter->value, job_count, __ATOMIC_ACQ_REL);
+
+	// NOTE: Checked under the mutex, the last decrement of the dependency
+	//       takes it too, so the task is either queued here or released
+	if (dependency) {
+		pthread_mutex_lock(&pool->mutex);
+		if (__atomic_load_n(&dependency->value, __ATOMIC_ACQUIRE) > 0) {
+			if (pool->waiting_count == pool->waiting_capacity) {
+				pool->waiting_capacity = pool->waiting_capacity ?
+					pool->waiting_capacity * 2 : 16;
+				pool->waiting = realloc(pool->waiting,
+					sizeof *pool->waiting * pool->waiting_capacity);
+			}
+			pool->waiting[pool->waiting_count++] = task;
+			pthread_mutex_unlock(&pool->mutex);
+			return;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+		task.dependency = NULL;
+	}
+
+	thread_pool_enqueue(pool, &task);
+} // thread_pool_submit_grain
+
+static inline void thread_pool_submit(thread_pool_t* pool, i32 job_count,
+	thread_pool_job_t job, void* data, thread_pool_counter_t* dependency,
+	thread_pool_counter_t* counter)
+{
+	thread_pool_submit_grain(pool, job_count, 1, job, data, dependency,
+		counter);
+} // thread_pool_submit
+
+// Blocks until the counter reaches zero, only called from outside the pool
+static inline void thread_pool_wait(thread_pool_t* pool,
+	thread_pool_counter_t* counter)
+{
+	if (pool == NULL) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (__atomic_load_n(&counter->value, __ATOMIC_ACQUIRE) > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+} // thread_pool_wait
+
+// Runs job for every index in [0, job_count) and returns once all are done,
+// pool may be NULL to run all jobs on the calling thread
+static inline void thread_pool_run(thread_pool_t* pool, i32 job_count,
+	thread_pool_job_t job, void* data)
+{
+	thread_pool_counter_t counter = { 0 };
+	thread_pool_submit(pool, job_count, job, data, NULL, &counter);
+	thread_pool_wait(pool, &counter);
+} // thread_pool_run
+
+#endif // THREAD_POOL_H
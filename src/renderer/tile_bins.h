@@ -0,0 +1,188 @@
+#ifndef TILE_BINS_H
+#define TILE_BINS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../math/mathlib.h"
+
+#include "entity3d.h"
+#include "framebuffer.h"
+#include "render_queue.h"
+#include "triangle3d.h"
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+#define TILE_SIZE 64
+#define TILE_CHUNK_PRIMITIVE_COUNT 512
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+// NOTE: A chunk holds the screen space triangles of a contiguous primitive
+//       range of one queued entity or instance. Chunks are rasterized in
+//       order, so the triangles of every tile are drawn in the same order as
+//       by the serial renderer.
+typedef struct tile_chunk_t {
+	render_queue_item_t* item;
+	u32 begin;
+	u32 end;
+	u32 triangle_count;
+	u32 triangle_capacity;
+	triangle3d_t* triangles;
+	u32 bin_offset_capacity;
+	u32* bin_offsets;
+	u32 bin_entry_capacity;
+	u32* bin_entries;
+} tile_chunk_t;
+
+// NOTE: width and height are the framebuffer size the triangles were
+//       projected and binned for
+typedef struct tile_bins_t {
+	i32 width;
+	i32 height;
+	i32 tiles_x;
+	i32 tiles_y;
+	i32 chunk_count;
+	i32 chunk_capacity;
+	tile_chunk_t* chunks;
+} tile_bins_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+static inline void tile_bins_resize(tile_bins_t* bins, framebuffer_t* fb) {
+	bins->width = fb->width;
+	bins->height = fb->height;
+	bins->tiles_x = (fb->width + TILE_SIZE - 1) / TILE_SIZE;
+	bins->tiles_y = (fb->height + TILE_SIZE - 1) / TILE_SIZE;
+} // tile_bins_resize
+
+static inline tile_chunk_t* tile_bins_push_chunk(tile_bins_t* bins) {
+	if (bins->chunk_count == bins->chunk_capacity) {
+		i32 capacity = bins->chunk_capacity ? bins->chunk_capacity * 2 : 16;
+		bins->chunks = realloc(bins->chunks, sizeof *bins->chunks * capacity);
+		memset(&bins->chunks[bins->chunk_capacity], 0,
+			sizeof *bins->chunks * (capacity - bins->chunk_capacity));
+		bins->chunk_capacity = capacity;
+	}
+	tile_chunk_t* chunk = &bins->chunks[bins->chunk_count++];
+	chunk->triangle_count = 0;
+	return chunk;
+} // tile_bins_push_chunk
+
+static inline void tile_bins_free(tile_bins_t* bins) {
+	for (i32 i = 0; i < bins->chunk_capacity; i++) {
+		free(bins->chunks[i].triangles);
+		free(bins->chunks[i].bin_offsets);
+		free(bins->chunks[i].bin_entries);
+	}
+	free(bins->chunks);
+	bins->chunks = NULL;
+	bins->chunk_count = 0;
+	bins->chunk_capacity = 0;
+} // tile_bins_free
+
+// Makes room for count more triangles and returns the first free one
+static inline triangle3d_t* tile_chunk_reserve(tile_chunk_t* chunk, u32 count)
+{
+	u32 required = chunk->triangle_count + count;
+	if (required > chunk->triangle_capacity) {
+		u32 capacity = chunk->triangle_capacity ?
+			chunk->triangle_capacity : 64;
+		while (capacity < required) capacity *= 2;
+		chunk->triangles = realloc(chunk->triangles,
+			sizeof *chunk->triangles * capacity);
+		chunk->triangle_capacity = capacity;
+	}
+	return &chunk->triangles[chunk->triangle_count];
+} // tile_chunk_reserve
+
+static inline i32 tile_bins_pixel_to_tile(f32 p, i32 tiles) {
+	// NOTE: Written so that NaN ends up in the first tile
+	if (!(p > 0.0f)) return 0;
+	i32 tile = (p >= (f32) (tiles * TILE_SIZE)) ?
+		tiles - 1 : (i32) p / TILE_SIZE;
+	return (tile < tiles) ? tile : tiles - 1;
+} // tile_bins_pixel_to_tile
+
+// Conservative tile rectangle [x0, x1] x [y0, y1] touched by the filled and
+// stroked triangle. Returns 0 if the triangle lies outside of the screen.
+static inline i32 tile_bins_triangle_rect(tile_bins_t* bins,
+	triangle3d_t* triangle, i32* x0, i32* y0, i32* x1, i32* y1)
+{
+	point4d_t* p1 = &triangle->p1.position;
+	point4d_t* p2 = &triangle->p2.position;
+	point4d_t* p3 = &triangle->p3.position;
+
+	f32 x_min = p1->x, x_max = p1->x;
+	f32 y_min = p1->y, y_max = p1->y;
+	if (p2->x < x_min) x_min = p2->x;
+	if (p3->x < x_min) x_min = p3->x;
+	if (p2->x > x_max) x_max = p2->x;
+	if (p3->x > x_max) x_max = p3->x;
+	if (p2->y < y_min) y_min = p2->y;
+	if (p3->y < y_min) y_min = p3->y;
+	if (p2->y > y_max) y_max = p2->y;
+	if (p3->y > y_max) y_max = p3->y;
+	x_min -= 1.0f;
+	y_min -= 1.0f;
+	x_max += 1.0f;
+	y_max += 1.0f;
+
+	if (x_max < 0.0f || y_max < 0.0f) return 0;
+	if (x_min >= (f32) (bins->tiles_x * TILE_SIZE)) return 0;
+	if (y_min >= (f32) (bins->tiles_y * TILE_SIZE)) return 0;
+
+	*x0 = tile_bins_pixel_to_tile(x_min, bins->tiles_x);
+	*x1 = tile_bins_pixel_to_tile(x_max, bins->tiles_x);
+	*y0 = tile_bins_pixel_to_tile(y_min, bins->tiles_y);
+	*y1 = tile_bins_pixel_to_tile(y_max, bins->tiles_y);
+	return 1;
+} // tile_bins_triangle_rect
+
+// Sorts the triangles of the chunk into per tile lists with a counting sort;
+// the triangles of tile t are bin_entries[bin_offsets[t]..bin_offsets[t+1]]
+static inline void tile_chunk_bin(tile_chunk_t* chunk, tile_bins_t* bins) {
+	u32 tile_count = bins->tiles_x * bins->tiles_y;
+	if (chunk->bin_offset_capacity < tile_count + 1) {
+		chunk->bin_offset_capacity = tile_count + 1;
+		chunk->bin_offsets = realloc(chunk->bin_offsets,
+			sizeof *chunk->bin_offsets * chunk->bin_offset_capacity);
+	}
+	u32* offsets = chunk->bin_offsets;
+	memset(offsets, 0, sizeof *offsets * (tile_count + 1));
+
+	for (u32 i = 0; i < chunk->triangle_count; i++) {
+		i32 x0, y0, x1, y1;
+		if (!tile_bins_triangle_rect(bins, &chunk->triangles[i],
+			&x0, &y0, &x1, &y1)) continue;
+		for (i32 ty = y0; ty <= y1; ty++)
+			for (i32 tx = x0; tx <= x1; tx++)
+				offsets[ty * bins->tiles_x + tx + 1]++;
+	}
+
+	for (u32 t = 0; t < tile_count; t++)
+		offsets[t + 1] += offsets[t];
+
+	u32 entry_count = offsets[tile_count];
+	if (chunk->bin_entry_capacity < entry_count) {
+		chunk->bin_entry_capacity = entry_count;
+		chunk->bin_entries = realloc(chunk->bin_entries,
+			sizeof *chunk->bin_entries * entry_count);
+	}
+
+	// NOTE: offsets[t] is used as write cursor and ends up as the start of
+	//       tile t + 1, shifting everything back restores the start offsets
+	for (u32 i = 0; i < chunk->triangle_count; i++) {
+		i32 x0, y0, x1, y1;
+		if (!tile_bins_triangle_rect(bins, &chunk->triangles[i],
+			&x0, &y0, &x1, &y1)) continue;
+		for (i32 ty = y0; ty <= y1; ty++)
+			for (i32 tx = x0; tx <= x1; tx++)
+				chunk->bin_entries[offsets[ty * bins->tiles_x + tx]++] = i;
+	}
+	for (u32 t = tile_count; t > 0; t--)
+		offsets[t] = offsets[t - 1];
+	offsets[0] = 0;
+} // tile_chunk_bin
+
+#endif // TILE_BINS_H
@@ -1,11 +1,19 @@
 #ifndef TRIANGLE3D_H
 #define TRIANGLE3D_H
 
+#include <float.h>
+
+#if defined(__SSE2__) && !defined(RENDERER_NO_SIMD)
+	#define TRIANGLE3D_SSE2
+	#include <emmintrin.h>
+#endif
+
 #include "line3d.h"
 #include "vertex3d.h"
 #include "framebuffer.h"
 #include "texture.h"
 #include "color_rgba.h"
+#include "render_stats.h"
 #include "../math/mathlib.h"
 
 // D E F I N E S ///////////////////////////////////////////////////////////////
@@ -17,6 +25,26 @@
 	(texture_t *) (texture), \
 }
 
+// Edge function rasterizer works on blocks of this many pixels per side,
+// the same blocks as the depth bounds of the framebuffer
+#define TRIANGLE3D_BLOCK_SIZE FRAMEBUFFER_DEPTH_BLOCK_SIZE
+// Texels with a lower alpha are discarded, same as an alpha below 0.1
+#define TRIANGLE3D_ALPHA_REF 26
+// The edge function rasterizer snaps the vertices to 28.4 fixed point
+#define TRIANGLE3D_SUBPIXEL_BITS 4
+#define TRIANGLE3D_SUBPIXEL_SCALE (1 << TRIANGLE3D_SUBPIXEL_BITS)
+
+// E N U M S ///////////////////////////////////////////////////////////////////
+
+// NOTE: RASTER_MODE_VISIBILITY uses the coverage of RASTER_MODE_EDGE but
+//       first resolves the visible triangle of every pixel and then shades
+//       each pixel once, see triangle3d_fill_visibility_rect
+typedef enum raster_mode_t {
+	RASTER_MODE_SCANLINE = 0,
+	RASTER_MODE_EDGE,
+	RASTER_MODE_VISIBILITY
+} raster_mode_t;
+
 // S T R U C T S ///////////////////////////////////////////////////////////////
 
 typedef struct triangle3d_t {
@@ -24,23 +52,44 @@ typedef struct triangle3d_t {
 	texture_t* texture;
 } triangle3d_t;
 
+// Linear function f(x, y) = a * x + b * y + c over the screen; used for the
+// attribute planes of a triangle
+typedef struct triangle3d_plane_t {
+	f32 a, b, c;
+} triangle3d_plane_t;
+
+// Edge function in 28.4 fixed point,
+// e(x, y) = a * (x - x0) + b * (y - y0) + bias. The bias is -1 for edges
+// that are not top or left edges, so a pixel is covered if e >= 0 for all
+// three edges and a pixel on a shared edge belongs to exactly one triangle.
+typedef struct triangle3d_edge_t {
+	i32 a, b;
+	i32 x0, y0;
+	i32 bias;
+} triangle3d_edge_t;
+
 // F U N C T I O N S ///////////////////////////////////////////////////////////
 
-static inline void triangle3d_stroke(framebuffer_t* fb, triangle3d_t* triangle)
+static inline void triangle3d_stroke_rect(framebuffer_t* fb,
+	triangle3d_t* triangle, i32 x_min, i32 y_min, i32 x_max, i32 y_max)
 {
 	line3d_t l1 = line3d(triangle->p1, triangle->p2);
 	line3d_t l2 = line3d(triangle->p2, triangle->p3);
 	line3d_t l3 = line3d(triangle->p3, triangle->p1);
 
-	line3d_stroke(fb, &l1);
-	line3d_stroke(fb, &l2);
-	line3d_stroke(fb, &l3);
-} // triangle3d_stroke
+	line3d_stroke_rect(fb, &l1, x_min, y_min, x_max, y_max);
+	line3d_stroke_rect(fb, &l2, x_min, y_min, x_max, y_max);
+	line3d_stroke_rect(fb, &l3, x_min, y_min, x_max, y_max);
+} // triangle3d_stroke_rect
 
-static inline void triangle3d_fill(framebuffer_t* fb,
-	triangle3d_t* triangle)
+static inline void triangle3d_stroke(framebuffer_t* fb, triangle3d_t* triangle)
 {
-	texture_t* tex = triangle->texture;
+	triangle3d_stroke_rect(fb, triangle, 0, 0, fb->width, fb->height);
+} // triangle3d_stroke
+
+// Sorts the vertices by y and premultiplies the attributes with 1/z,
+// must be called once before triangle3d_fill_rect
+static inline void triangle3d_setup(triangle3d_t* triangle) {
 	vertex3d_t* v1 = &triangle->p1;
 	vertex3d_t* v2 = &triangle->p2;
 	vertex3d_t* v3 = &triangle->p3;
@@ -63,12 +112,30 @@ static inline void triangle3d_fill(framebuffer_t* fb,
 	vector3d_multiply_float(&v1->color.rgb, &v1->color.rgb, v1->position.z);
 	vector3d_multiply_float(&v2->color.rgb, &v2->color.rgb, v2->position.z);
 	vector3d_multiply_float(&v3->color.rgb, &v3->color.rgb, v3->position.z);
+} // triangle3d_setup
+
+// Fills the pixels of a set up triangle that lie inside of
+// [x_min, x_max) x [y_min, y_max); the rectangle has to be inside of fb.
+// Every pixel gets the same value as if the whole triangle was filled,
+// so a triangle split over several rectangles draws bit-identically.
+// stats may be NULL.
+static inline void triangle3d_fill_rect(framebuffer_t* fb,
+	triangle3d_t* triangle, i32 x_min, i32 y_min, i32 x_max, i32 y_max,
+	render_stats_t* stats)
+{
+	texture_t* tex = triangle->texture;
+	vertex3d_t* v1 = &triangle->p1;
+	vertex3d_t* v2 = &triangle->p2;
+	vertex3d_t* v3 = &triangle->p3;
+	color_layout_t layout = color_layout(fb->image_format);
 
 	vertex3d_t v, vl, vr;
 	i32 p1y = floor(v1->position.y);
 	i32 p2y = floor(v2->position.y);
 	i32 p3y = floor(v3->position.y);
-	for (f32 y = p1y; y < p3y; y++) {
+	i32 y_start = (p1y > y_min) ? p1y : y_min;
+	i32 y_end = (p3y < y_max) ? p3y : y_max;
+	for (f32 y = y_start; y < y_end; y++) {
 		if (y < p2y) {
 			f32 dl = (f32) (y - p1y) / (p2y - p1y);
 			vertex3d_lerp(&vl, v1, v2, dl);
@@ -85,13 +152,21 @@ static inline void triangle3d_fill(framebuffer_t* fb,
 
 		i32 xl = floor(vl.position.x);
 		i32 xr = floor(vr.position.x);
-		for (i32 x = xl; x < xr; x++) {
+		i32 x_start = (xl > x_min) ? xl : x_min;
+		i32 x_end = (xr < x_max) ? xr : x_max;
+		for (i32 x = x_start; x < x_end; x++) {
 			f32 x_norm = (f32) (x - xl) / (xr - xl);
 			f32 z = lerp(vl.position.z, vr.position.z, x_norm);
 			f32 z_inv = 1.0f / z;
-			if (get_depth(fb, x, y) < z_inv) continue;
+			i32 index = framebuffer_index(fb, x, y);
+			render_stats_add(stats, RENDER_STATS_PIXELS_TESTED, 1);
+			if (fb->depth[index] < z_inv) {
+				render_stats_add(stats, RENDER_STATS_PIXELS_DEPTH_REJECTED, 1);
+				continue;
+			}
 
 			vertex3d_lerp(&v, &vl, &vr, x_norm);
+			render_stats_add(stats, RENDER_STATS_PIXELS_SHADED, 1);
 
 			vector2d_multiply_float(
 				&v.texcoord,
@@ -108,29 +183,982 @@ static inline void triangle3d_fill(framebuffer_t* fb,
 			i32 tu = v.texcoord.u * tex->width;
 			i32 tv = v.texcoord.v * tex->height;
 
-			i32 index = (tv * tex->width + tu);
-			index = clamp(index, 0, tex->width * tex->height - 1);
-			color_rgba_t c = tex->data[index];
+			color_rgba_t c;
+			color_from_argb(&c, tex->data[texture_texel_index(tex, tu, tv)]);
 			vector3d_multiply(&c.rgb, &c.rgb, &v.color.rgb);
-			if (c.a < 0.1f) continue;
-			set_depth(fb, x, y, z_inv);
-			set_pixel(fb, x, y, &c);
+			if (c.a < 0.1f) {
+				render_stats_add(stats, RENDER_STATS_PIXELS_ALPHA_REJECTED, 1);
+				continue;
+			}
+			fb->depth[index] = z_inv;
+			fb->color[index] = color_pack_float(&layout, &c);
+			render_stats_add(stats, RENDER_STATS_PIXELS_WRITTEN, 1);
 		}
 	}
+} // triangle3d_fill_rect
+
+static inline void triangle3d_fill(framebuffer_t* fb,
+	triangle3d_t* triangle)
+{
+	triangle3d_setup(triangle);
+	triangle3d_fill_rect(fb, triangle, 0, 0, fb->width, fb->height, NULL);
 } // triangle3d_fill
 
-static inline i32 triangle3d_clip(vertex3d_t* out, vertex3d_t* in, plane3d_t* p,
-	i32 in_count)
+static inline f32 triangle3d_plane_at(triangle3d_plane_t* plane, f32 x, f32 y)
+{
+	return plane->a * x + plane->b * y + plane->c;
+} // triangle3d_plane_at
+
+// Snaps a screen coordinate to 28.4 fixed point
+static inline i32 triangle3d_snap(f32 x) {
+	return (i32) floorf(x * TRIANGLE3D_SUBPIXEL_SCALE + 0.5f);
+} // triangle3d_snap
+
+// Edge function of p1 -> p2 for snapped vertices, zero on the edge and equal
+// to the doubled signed triangle area at the third vertex
+static inline void triangle3d_edge(triangle3d_edge_t* out, i32 x1, i32 y1,
+	i32 x2, i32 y2)
+{
+	out->a = y1 - y2;
+	out->b = x2 - x1;
+	out->x0 = x1;
+	out->y0 = y1;
+	out->bias = 0;
+} // triangle3d_edge
+
+// Value of the edge function at the center of pixel (x, y), in 24.8
+static inline i64 triangle3d_edge_at(triangle3d_edge_t* e, i32 x, i32 y) {
+	i64 fx = (i64) x * TRIANGLE3D_SUBPIXEL_SCALE +
+		TRIANGLE3D_SUBPIXEL_SCALE / 2 - e->x0;
+	i64 fy = (i64) y * TRIANGLE3D_SUBPIXEL_SCALE +
+		TRIANGLE3D_SUBPIXEL_SCALE / 2 - e->y0;
+	return (i64) e->a * fx + (i64) e->b * fy + e->bias;
+} // triangle3d_edge_at
+
+// Plane through (p1, f1), (p2, f2), (p3, f3); area_inv is the inverse of the
+// doubled signed triangle area
+static inline void triangle3d_attribute_plane(triangle3d_plane_t* out,
+	point4d_t* p1, point4d_t* p2, point4d_t* p3, f32 f1, f32 f2, f32 f3,
+	f32 area_inv)
+{
+	f32 df2 = f2 - f1;
+	f32 df3 = f3 - f1;
+	out->a = (df2 * (p3->y - p1->y) - df3 * (p2->y - p1->y)) * area_inv;
+	out->b = (df3 * (p2->x - p1->x) - df2 * (p3->x - p1->x)) * area_inv;
+	out->c = f1 - out->a * p1->x - out->b * p1->y;
+} // triangle3d_attribute_plane
+
+// Per triangle state of the edge function rasterizer
+typedef struct triangle3d_raster_t {
+	triangle3d_edge_t edges[3];
+	// NOTE: Steps of the edge functions per pixel in the current block,
+	//       zero for edges that cover the whole block
+	i32 edge_step_x[3];
+	i32 edge_step_y[3];
+	triangle3d_plane_t w, u, v, r, g, b;
+	texture_t texture;
+	texture_filter_t filter;
+	// NOTE: Mip levels of the current block, see
+	//       triangle3d_raster_select_level
+	texture_t level;
+	texture_t level_next;
+	u32 level_weight;
+	f32 level_scale_u, level_scale_v;
+	f32 level_next_scale_u, level_next_scale_v;
+	color_layout_t layout;
+	render_stats_t* stats;
+	// NOTE: Visibility pass only, alpha_test is set if the texture has
+	//       texels that are discarded
+	u32 id;
+	i32 alpha_test;
+} triangle3d_raster_t;
+
+// Returns 0 for degenerate triangles
+static inline i32 triangle3d_raster_setup(triangle3d_raster_t* raster,
+	framebuffer_t* fb, triangle3d_t* triangle)
+{
+	vertex3d_t* v1 = &triangle->p1;
+	vertex3d_t* v2 = &triangle->p2;
+	vertex3d_t* v3 = &triangle->p3;
+
+	i32 x1 = triangle3d_snap(v1->position.x);
+	i32 y1 = triangle3d_snap(v1->position.y);
+	i32 x2 = triangle3d_snap(v2->position.x);
+	i32 y2 = triangle3d_snap(v2->position.y);
+	i32 x3 = triangle3d_snap(v3->position.x);
+	i32 y3 = triangle3d_snap(v3->position.y);
+	i64 area = (i64) (x2 - x1) * (y3 - y1) - (i64) (x3 - x1) * (y2 - y1);
+	if (area == 0) return 0;
+
+	// Edge functions oriented to be positive inside of the triangle
+	triangle3d_edge(&raster->edges[0], x2, y2, x3, y3);
+	triangle3d_edge(&raster->edges[1], x3, y3, x1, y1);
+	triangle3d_edge(&raster->edges[2], x1, y1, x2, y2);
+	for (i32 i = 0; i < 3; i++) {
+		triangle3d_edge_t* e = &raster->edges[i];
+		if (area < 0) {
+			e->a = -e->a;
+			e->b = -e->b;
+		}
+		// NOTE: Pixels exactly on an edge belong to the triangle only if
+		//       it is a top or left edge, others require e > 0
+		i32 top_left = (e->a > 0) || (e->a == 0 && e->b > 0);
+		e->bias = top_left ? 0 : -1;
+	}
+
+	// Attribute planes through the snapped vertices, the attributes are
+	// already divided by z and the texture coordinates are scaled to texels
+	const f32 subpixel = 1.0f / TRIANGLE3D_SUBPIXEL_SCALE;
+	point4d_t sp1 = point4d(x1 * subpixel, y1 * subpixel, v1->position.z);
+	point4d_t sp2 = point4d(x2 * subpixel, y2 * subpixel, v2->position.z);
+	point4d_t sp3 = point4d(x3 * subpixel, y3 * subpixel, v3->position.z);
+	point4d_t* p1 = &sp1;
+	point4d_t* p2 = &sp2;
+	point4d_t* p3 = &sp3;
+	texture_t* tex = triangle->texture;
+	f32 tex_width = tex->width;
+	f32 tex_height = tex->height;
+	f32 area_inv = (f32) (TRIANGLE3D_SUBPIXEL_SCALE *
+		TRIANGLE3D_SUBPIXEL_SCALE) / (f32) area;
+	triangle3d_attribute_plane(&raster->w, p1, p2, p3,
+		p1->z, p2->z, p3->z, area_inv);
+	triangle3d_attribute_plane(&raster->u, p1, p2, p3,
+		v1->texcoord.u * tex_width, v2->texcoord.u * tex_width,
+		v3->texcoord.u * tex_width, area_inv);
+	triangle3d_attribute_plane(&raster->v, p1, p2, p3,
+		v1->texcoord.v * tex_height, v2->texcoord.v * tex_height,
+		v3->texcoord.v * tex_height, area_inv);
+	triangle3d_attribute_plane(&raster->r, p1, p2, p3,
+		v1->color.r, v2->color.r, v3->color.r, area_inv);
+	triangle3d_attribute_plane(&raster->g, p1, p2, p3,
+		v1->color.g, v2->color.g, v3->color.g, area_inv);
+	triangle3d_attribute_plane(&raster->b, p1, p2, p3,
+		v1->color.b, v2->color.b, v3->color.b, area_inv);
+
+	raster->texture = *tex;
+	raster->filter = tex->filter;
+	raster->id = 0;
+	raster->alpha_test = tex->alpha_min < TRIANGLE3D_ALPHA_REF;
+	texture_level(&raster->level, tex, 0);
+	texture_level(&raster->level_next, tex, 0);
+	raster->level_weight = 0;
+	raster->level_scale_u = 1.0f;
+	raster->level_scale_v = 1.0f;
+	raster->level_next_scale_u = 1.0f;
+	raster->level_next_scale_v = 1.0f;
+
+	raster->layout = color_layout(fb->image_format);
+
+	return 1;
+} // triangle3d_raster_setup
+
+// Channel layout of the framebuffer, a compile time constant if the image
+// format is fixed with RENDERER_IMAGE_FORMAT
+static inline color_layout_t triangle3d_raster_layout(
+	triangle3d_raster_t* raster)
+{
+#ifdef RENDERER_IMAGE_FORMAT
+	(void) raster;
+	return color_layout(RENDERER_IMAGE_FORMAT);
+#else
+	return raster->layout;
+#endif
+} // triangle3d_raster_layout
+
+// Selects the mip levels for the pixels around (fx, fy) from the screen
+// space derivatives of the texel coordinates there
+static inline void triangle3d_raster_select_level(triangle3d_raster_t* raster,
+	f32 fx, f32 fy)
+{
+	texture_t* tex = &raster->texture;
+	f32 lod = 0.0f;
+	f32 w = triangle3d_plane_at(&raster->w, fx, fy);
+	if (w > 0.0f) {
+		f32 z = 1.0f / w;
+		f32 u = triangle3d_plane_at(&raster->u, fx, fy) * z;
+		f32 v = triangle3d_plane_at(&raster->v, fx, fy) * z;
+		f32 dudx = (raster->u.a - u * raster->w.a) * z;
+		f32 dvdx = (raster->v.a - v * raster->w.a) * z;
+		f32 dudy = (raster->u.b - u * raster->w.b) * z;
+		f32 dvdy = (raster->v.b - v * raster->w.b) * z;
+		f32 rho_x = dudx * dudx + dvdx * dvdx;
+		f32 rho_y = dudy * dudy + dvdy * dvdy;
+		f32 rho = (rho_x > rho_y) ? rho_x : rho_y;
+		// NOTE: Written so that NaN stays at the base level
+		if (rho > 1.0f) lod = 0.5f * texture_log2_approx(rho);
+	}
+
+	i32 level_last = tex->level_count - 1;
+	i32 level;
+	u32 weight = 0;
+	if (raster->filter == TEXTURE_FILTER_TRILINEAR) {
+		level = (i32) lod;
+		weight = (u32) ((lod - (f32) level) * 256.0f);
+	} else {
+		level = (i32) (lod + 0.5f);
+	}
+	if (level >= level_last) {
+		level = level_last;
+		weight = 0;
+	}
+
+	texture_level(&raster->level, tex, level);
+	texture_level(&raster->level_next, tex, level + 1);
+	raster->level_weight = weight;
+	raster->level_scale_u = (f32) raster->level.width / tex->width;
+	raster->level_scale_v = (f32) raster->level.height / tex->height;
+	raster->level_next_scale_u = (f32) raster->level_next.width / tex->width;
+	raster->level_next_scale_v = (f32) raster->level_next.height /
+		tex->height;
+} // triangle3d_raster_select_level
+
+// Samples the current levels at (u, v) given in base level texels
+static inline u32 triangle3d_raster_sample(triangle3d_raster_t* raster,
+	texture_t* level, texture_t* level_next, f32 u, f32 v)
+{
+	switch (raster->filter) {
+		case TEXTURE_FILTER_BILINEAR:
+			return texture_sample_bilinear(level,
+				u * raster->level_scale_u, v * raster->level_scale_v);
+		case TEXTURE_FILTER_TRILINEAR: {
+			u32 texel = texture_sample_bilinear(level,
+				u * raster->level_scale_u, v * raster->level_scale_v);
+			if (!raster->level_weight) return texel;
+			u32 texel_next = texture_sample_bilinear(level_next,
+				u * raster->level_next_scale_u,
+				v * raster->level_next_scale_v);
+			return texture_lerp_texel(texel, texel_next,
+				raster->level_weight);
+		}
+		case TEXTURE_FILTER_NEAREST:
+		default:
+			return texture_sample_nearest(level,
+				u * raster->level_scale_u, v * raster->level_scale_v);
+	}
+} // triangle3d_raster_sample
+
+// Shades the pixels [x_start, x_end) of the row at pixel center fy one at a
+// time. edges holds the edge functions at x_start or is NULL if the span is
+// inside of the triangle. Returns nonzero if any pixel was written.
+static inline i32 triangle3d_raster_span_scalar(triangle3d_raster_t* raster,
+	f32* depth_row, u32* color_row, i32 x_start, i32 x_end, f32 fy,
+	i32* edges)
+{
+	i32 e0 = 0, e1 = 0, e2 = 0;
+	i32 step0 = 0, step1 = 0, step2 = 0;
+	if (edges) {
+		e0 = edges[0];
+		e1 = edges[1];
+		e2 = edges[2];
+		step0 = raster->edge_step_x[0];
+		step1 = raster->edge_step_x[1];
+		step2 = raster->edge_step_x[2];
+	}
+	f32 row_w = raster->w.b * fy + raster->w.c;
+	f32 row_u = raster->u.b * fy + raster->u.c;
+	f32 row_v = raster->v.b * fy + raster->v.c;
+	f32 row_r = raster->r.b * fy + raster->r.c;
+	f32 row_g = raster->g.b * fy + raster->g.c;
+	f32 row_b = raster->b.b * fy + raster->b.c;
+	// NOTE: Local copies so the texture fields stay in registers while
+	//       the color row is written
+	texture_t tex = raster->level;
+	texture_t tex_next = raster->level_next;
+	color_layout_t layout = triangle3d_raster_layout(raster);
+	i32 written = 0;
+
+	for (i32 x = x_start; x < x_end;
+		x++, e0 += step0, e1 += step1, e2 += step2)
+	{
+		f32 fx = x + 0.5f;
+		if ((e0 | e1 | e2) < 0) continue;
+
+		// Depth test before any attribute work,
+		// depth < 1 / w written without the divide
+		f32 w = raster->w.a * fx + row_w;
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_TESTED, 1);
+		if (depth_row[x] * w < 1.0f) {
+			render_stats_add(raster->stats,
+				RENDER_STATS_PIXELS_DEPTH_REJECTED, 1);
+			continue;
+		}
+
+		f32 z = 1.0f / w;
+		f32 u = (raster->u.a * fx + row_u) * z;
+		f32 v = (raster->v.a * fx + row_v) * z;
+		u32 texel = triangle3d_raster_sample(raster, &tex, &tex_next, u, v);
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_SHADED, 1);
+		u32 a = texel_a(texel);
+		if (a < TRIANGLE3D_ALPHA_REF) {
+			render_stats_add(raster->stats,
+				RENDER_STATS_PIXELS_ALPHA_REJECTED, 1);
+			continue;
+		}
+
+		u32 r = texel_r(texel) * ((raster->r.a * fx + row_r) * z);
+		u32 g = texel_g(texel) * ((raster->g.a * fx + row_g) * z);
+		u32 b = texel_b(texel) * ((raster->b.a * fx + row_b) * z);
+
+		depth_row[x] = z;
+		color_row[x] = color_pack(&layout, r, g, b, a);
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_WRITTEN, 1);
+		written = 1;
+	}
+	return written;
+} // triangle3d_raster_span_scalar
+
+#ifdef TRIANGLE3D_SSE2
+static inline i32 triangle3d_lane_count(__m128 mask) {
+	return __builtin_popcount(_mm_movemask_ps(mask));
+} // triangle3d_lane_count
+
+// Packs the colors of four pixels, r, g and b in [0, 256) and a in [0, 255].
+// The shifts are immediates if the layout is a compile time constant.
+static inline __m128i triangle3d_pack_sse2(color_layout_t* layout, __m128 r,
+	__m128 g, __m128 b, __m128i a)
+{
+	return _mm_or_si128(
+		_mm_or_si128(
+			_mm_sll_epi32(_mm_cvttps_epi32(r),
+				_mm_cvtsi32_si128(layout->shift_r)),
+			_mm_sll_epi32(_mm_cvttps_epi32(g),
+				_mm_cvtsi32_si128(layout->shift_g))),
+		_mm_or_si128(
+			_mm_sll_epi32(_mm_cvttps_epi32(b),
+				_mm_cvtsi32_si128(layout->shift_b)),
+			_mm_sll_epi32(a, _mm_cvtsi32_si128(layout->shift_a))));
+} // triangle3d_pack_sse2
+
+// Shades the row four pixels at a time with a lane mask for coverage, depth
+// and alpha test; every pixel gets the same value as in the scalar path
+static inline i32 triangle3d_raster_span_sse2(triangle3d_raster_t* raster,
+	f32* depth_row, u32* color_row, i32 x_start, i32 x_end, f32 fy,
+	i32* edges)
+{
+	// NOTE: The edge functions of the four pixels, stepped by four pixels
+	__m128i e0 = _mm_setzero_si128();
+	__m128i e1 = _mm_setzero_si128();
+	__m128i e2 = _mm_setzero_si128();
+	__m128i e0_step = _mm_setzero_si128();
+	__m128i e1_step = _mm_setzero_si128();
+	__m128i e2_step = _mm_setzero_si128();
+	if (edges) {
+		i32* steps = raster->edge_step_x;
+		e0 = _mm_setr_epi32(edges[0], edges[0] + steps[0],
+			edges[0] + 2 * steps[0], edges[0] + 3 * steps[0]);
+		e1 = _mm_setr_epi32(edges[1], edges[1] + steps[1],
+			edges[1] + 2 * steps[1], edges[1] + 3 * steps[1]);
+		e2 = _mm_setr_epi32(edges[2], edges[2] + steps[2],
+			edges[2] + 2 * steps[2], edges[2] + 3 * steps[2]);
+		e0_step = _mm_set1_epi32(4 * steps[0]);
+		e1_step = _mm_set1_epi32(4 * steps[1]);
+		e2_step = _mm_set1_epi32(4 * steps[2]);
+	}
+	__m128 row_w = _mm_set1_ps(raster->w.b * fy + raster->w.c);
+	__m128 row_u = _mm_set1_ps(raster->u.b * fy + raster->u.c);
+	__m128 row_v = _mm_set1_ps(raster->v.b * fy + raster->v.c);
+	__m128 row_r = _mm_set1_ps(raster->r.b * fy + raster->r.c);
+	__m128 row_g = _mm_set1_ps(raster->g.b * fy + raster->g.c);
+	__m128 row_b = _mm_set1_ps(raster->b.b * fy + raster->b.c);
+	__m128 w_a = _mm_set1_ps(raster->w.a);
+	__m128 u_a = _mm_set1_ps(raster->u.a);
+	__m128 v_a = _mm_set1_ps(raster->v.a);
+	__m128 r_a = _mm_set1_ps(raster->r.a);
+	__m128 g_a = _mm_set1_ps(raster->g.a);
+	__m128 b_a = _mm_set1_ps(raster->b.a);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128i minus_one = _mm_set1_epi32(-1);
+	__m128i alpha_ref = _mm_set1_epi32(TRIANGLE3D_ALPHA_REF);
+	__m128i channel_mask = _mm_set1_epi32(0xFF);
+	__m128 lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	color_layout_t layout = triangle3d_raster_layout(raster);
+
+	texture_t tex = raster->level;
+	texture_t tex_next = raster->level_next;
+	i32 nearest = raster->filter == TEXTURE_FILTER_NEAREST;
+	i32 wrap_pow2 = tex.address == TEXTURE_ADDRESS_WRAP &&
+		tex.width_shift >= 0;
+	__m128 scale_u = _mm_set1_ps(raster->level_scale_u);
+	__m128 scale_v = _mm_set1_ps(raster->level_scale_v);
+	__m128i width_mask = _mm_set1_epi32(tex.width_mask);
+	__m128i height_mask = _mm_set1_epi32(tex.height_mask);
+	__m128i width_shift = _mm_cvtsi32_si128(wrap_pow2 ? tex.width_shift : 0);
+
+	i32 written = 0;
+	i32 x = x_start;
+	for (; x + 4 <= x_end; x += 4) {
+		__m128 fx = _mm_add_ps(_mm_set1_ps((f32) x), lane_offsets);
+
+		__m128 mask = _mm_castsi128_ps(minus_one);
+		if (edges) {
+			// A pixel is covered if no edge function is negative
+			__m128i e_or = _mm_or_si128(_mm_or_si128(e0, e1), e2);
+			e0 = _mm_add_epi32(e0, e0_step);
+			e1 = _mm_add_epi32(e1, e1_step);
+			e2 = _mm_add_epi32(e2, e2_step);
+			mask = _mm_castsi128_ps(_mm_cmpgt_epi32(e_or, minus_one));
+			if (!_mm_movemask_ps(mask)) continue;
+		}
+
+		__m128 w = _mm_add_ps(_mm_mul_ps(w_a, fx), row_w);
+		__m128 depth = _mm_loadu_ps(&depth_row[x]);
+		__m128 depth_fail = _mm_cmplt_ps(_mm_mul_ps(depth, w), one);
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_TESTED,
+			triangle3d_lane_count(mask));
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_DEPTH_REJECTED,
+			triangle3d_lane_count(_mm_and_ps(depth_fail, mask)));
+		mask = _mm_andnot_ps(depth_fail, mask);
+		if (!_mm_movemask_ps(mask)) continue;
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_SHADED,
+			triangle3d_lane_count(mask));
+
+		__m128 z = _mm_div_ps(one, w);
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(u_a, fx), row_u), z);
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(v_a, fx), row_v), z);
+
+		// NOTE: SSE2 has no gather, the texels are fetched one by one
+		__m128i texels;
+		if (nearest) {
+			__m128i tu = _mm_cvttps_epi32(_mm_mul_ps(u, scale_u));
+			__m128i tv = _mm_cvttps_epi32(_mm_mul_ps(v, scale_v));
+			i32 indices[4];
+			if (wrap_pow2) {
+				_mm_storeu_si128((__m128i *) indices, _mm_or_si128(
+					_mm_sll_epi32(_mm_and_si128(tv, height_mask),
+						width_shift),
+					_mm_and_si128(tu, width_mask)));
+			} else {
+				i32 tus[4], tvs[4];
+				_mm_storeu_si128((__m128i *) tus, tu);
+				_mm_storeu_si128((__m128i *) tvs, tv);
+				for (i32 i = 0; i < 4; i++)
+					indices[i] = texture_texel_index(&tex, tus[i], tvs[i]);
+			}
+			texels = _mm_setr_epi32(
+				tex.data[indices[0]], tex.data[indices[1]],
+				tex.data[indices[2]], tex.data[indices[3]]);
+		} else {
+			f32 us[4], vs[4];
+			u32 filtered[4];
+			_mm_storeu_ps(us, u);
+			_mm_storeu_ps(vs, v);
+			for (i32 i = 0; i < 4; i++) {
+				filtered[i] = triangle3d_raster_sample(raster, &tex,
+					&tex_next, us[i], vs[i]);
+			}
+			texels = _mm_loadu_si128((__m128i *) filtered);
+		}
+
+		__m128i a = _mm_srli_epi32(texels, 24);
+		__m128 alpha_fail = _mm_castsi128_ps(_mm_cmplt_epi32(a, alpha_ref));
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_ALPHA_REJECTED,
+			triangle3d_lane_count(_mm_and_ps(alpha_fail, mask)));
+		mask = _mm_andnot_ps(alpha_fail, mask);
+		i32 lanes = _mm_movemask_ps(mask);
+		if (!lanes) continue;
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_WRITTEN,
+			__builtin_popcount(lanes));
+
+		__m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(
+			_mm_srli_epi32(texels, 16), channel_mask)), _mm_mul_ps(
+			_mm_add_ps(_mm_mul_ps(r_a, fx), row_r), z));
+		__m128 g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(
+			_mm_srli_epi32(texels, 8), channel_mask)), _mm_mul_ps(
+			_mm_add_ps(_mm_mul_ps(g_a, fx), row_g), z));
+		__m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(
+			texels, channel_mask)), _mm_mul_ps(
+			_mm_add_ps(_mm_mul_ps(b_a, fx), row_b), z));
+		__m128i color = triangle3d_pack_sse2(&layout, r, g, b, a);
+
+		__m128i mask_i = _mm_castps_si128(mask);
+		__m128i color_old = _mm_loadu_si128((__m128i *) &color_row[x]);
+		depth = _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, depth));
+		color = _mm_or_si128(_mm_and_si128(mask_i, color),
+			_mm_andnot_si128(mask_i, color_old));
+		_mm_storeu_ps(&depth_row[x], depth);
+		_mm_storeu_si128((__m128i *) &color_row[x], color);
+		written = 1;
+	}
+
+	i32 tail[3] = {
+		_mm_cvtsi128_si32(e0), _mm_cvtsi128_si32(e1), _mm_cvtsi128_si32(e2)
+	};
+	written |= triangle3d_raster_span_scalar(raster, depth_row, color_row,
+		x, x_end, fy, edges ? tail : NULL);
+	return written;
+} // triangle3d_raster_span_sse2
+#endif
+
+// Visibility pass of the pixels [x_start, x_end) of the row at pixel center
+// fy, see triangle3d_raster_span_scalar. Covered pixels that pass the depth
+// and alpha test get the depth and the id of the triangle; only textures
+// with discarded texels are sampled.
+static inline i32 triangle3d_raster_span_visibility_scalar(
+	triangle3d_raster_t* raster, f32* depth_row, u32* id_row, i32 x_start,
+	i32 x_end, f32 fy, i32* edges)
+{
+	i32 e0 = 0, e1 = 0, e2 = 0;
+	i32 step0 = 0, step1 = 0, step2 = 0;
+	if (edges) {
+		e0 = edges[0];
+		e1 = edges[1];
+		e2 = edges[2];
+		step0 = raster->edge_step_x[0];
+		step1 = raster->edge_step_x[1];
+		step2 = raster->edge_step_x[2];
+	}
+	f32 row_w = raster->w.b * fy + raster->w.c;
+	f32 row_u = raster->u.b * fy + raster->u.c;
+	f32 row_v = raster->v.b * fy + raster->v.c;
+	texture_t tex = raster->level;
+	texture_t tex_next = raster->level_next;
+	i32 written = 0;
+
+	for (i32 x = x_start; x < x_end;
+		x++, e0 += step0, e1 += step1, e2 += step2)
+	{
+		f32 fx = x + 0.5f;
+		if ((e0 | e1 | e2) < 0) continue;
+
+		f32 w = raster->w.a * fx + row_w;
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_TESTED, 1);
+		if (depth_row[x] * w < 1.0f) {
+			render_stats_add(raster->stats,
+				RENDER_STATS_PIXELS_DEPTH_REJECTED, 1);
+			continue;
+		}
+
+		f32 z = 1.0f / w;
+		if (raster->alpha_test) {
+			f32 u = (raster->u.a * fx + row_u) * z;
+			f32 v = (raster->v.a * fx + row_v) * z;
+			u32 texel = triangle3d_raster_sample(raster, &tex, &tex_next,
+				u, v);
+			if (texel_a(texel) < TRIANGLE3D_ALPHA_REF) {
+				render_stats_add(raster->stats,
+					RENDER_STATS_PIXELS_ALPHA_REJECTED, 1);
+				continue;
+			}
+		}
+
+		depth_row[x] = z;
+		id_row[x] = raster->id;
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_WRITTEN, 1);
+		written = 1;
+	}
+	return written;
+} // triangle3d_raster_span_visibility_scalar
+
+#ifdef TRIANGLE3D_SSE2
+// Four pixel version of triangle3d_raster_span_visibility_scalar, alpha
+// tested triangles use the scalar path
+static inline i32 triangle3d_raster_span_visibility_sse2(
+	triangle3d_raster_t* raster, f32* depth_row, u32* id_row, i32 x_start,
+	i32 x_end, f32 fy, i32* edges)
+{
+	if (raster->alpha_test) {
+		return triangle3d_raster_span_visibility_scalar(raster, depth_row,
+			id_row, x_start, x_end, fy, edges);
+	}
+
+	__m128i e0 = _mm_setzero_si128();
+	__m128i e1 = _mm_setzero_si128();
+	__m128i e2 = _mm_setzero_si128();
+	__m128i e0_step = _mm_setzero_si128();
+	__m128i e1_step = _mm_setzero_si128();
+	__m128i e2_step = _mm_setzero_si128();
+	if (edges) {
+		i32* steps = raster->edge_step_x;
+		e0 = _mm_setr_epi32(edges[0], edges[0] + steps[0],
+			edges[0] + 2 * steps[0], edges[0] + 3 * steps[0]);
+		e1 = _mm_setr_epi32(edges[1], edges[1] + steps[1],
+			edges[1] + 2 * steps[1], edges[1] + 3 * steps[1]);
+		e2 = _mm_setr_epi32(edges[2], edges[2] + steps[2],
+			edges[2] + 2 * steps[2], edges[2] + 3 * steps[2]);
+		e0_step = _mm_set1_epi32(4 * steps[0]);
+		e1_step = _mm_set1_epi32(4 * steps[1]);
+		e2_step = _mm_set1_epi32(4 * steps[2]);
+	}
+	__m128 row_w = _mm_set1_ps(raster->w.b * fy + raster->w.c);
+	__m128 w_a = _mm_set1_ps(raster->w.a);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128i minus_one = _mm_set1_epi32(-1);
+	__m128 lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	__m128i id = _mm_set1_epi32(raster->id);
+
+	i32 written = 0;
+	i32 x = x_start;
+	for (; x + 4 <= x_end; x += 4) {
+		__m128 fx = _mm_add_ps(_mm_set1_ps((f32) x), lane_offsets);
+
+		__m128 mask = _mm_castsi128_ps(minus_one);
+		if (edges) {
+			__m128i e_or = _mm_or_si128(_mm_or_si128(e0, e1), e2);
+			e0 = _mm_add_epi32(e0, e0_step);
+			e1 = _mm_add_epi32(e1, e1_step);
+			e2 = _mm_add_epi32(e2, e2_step);
+			mask = _mm_castsi128_ps(_mm_cmpgt_epi32(e_or, minus_one));
+			if (!_mm_movemask_ps(mask)) continue;
+		}
+
+		__m128 w = _mm_add_ps(_mm_mul_ps(w_a, fx), row_w);
+		__m128 depth = _mm_loadu_ps(&depth_row[x]);
+		__m128 depth_fail = _mm_cmplt_ps(_mm_mul_ps(depth, w), one);
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_TESTED,
+			triangle3d_lane_count(mask));
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_DEPTH_REJECTED,
+			triangle3d_lane_count(_mm_and_ps(depth_fail, mask)));
+		mask = _mm_andnot_ps(depth_fail, mask);
+		if (!_mm_movemask_ps(mask)) continue;
+		render_stats_add(raster->stats, RENDER_STATS_PIXELS_WRITTEN,
+			triangle3d_lane_count(mask));
+
+		__m128 z = _mm_div_ps(one, w);
+		__m128i mask_i = _mm_castps_si128(mask);
+		__m128i id_old = _mm_loadu_si128((__m128i *) &id_row[x]);
+		depth = _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, depth));
+		__m128i ids = _mm_or_si128(_mm_and_si128(mask_i, id),
+			_mm_andnot_si128(mask_i, id_old));
+		_mm_storeu_ps(&depth_row[x], depth);
+		_mm_storeu_si128((__m128i *) &id_row[x], ids);
+		written = 1;
+	}
+
+	i32 tail[3] = {
+		_mm_cvtsi128_si32(e0), _mm_cvtsi128_si32(e1), _mm_cvtsi128_si32(e2)
+	};
+	written |= triangle3d_raster_span_visibility_scalar(raster, depth_row,
+		id_row, x, x_end, fy, edges ? tail : NULL);
+	return written;
+} // triangle3d_raster_span_visibility_sse2
+#endif
+
+// Shading pass of the pixels [x_start, x_end) of the row at pixel center fy
+// that the visibility pass resolved to the triangle of raster. Computes the
+// same colors as the color spans from the depth row, which holds 1 / w.
+static inline void triangle3d_raster_shade_span(triangle3d_raster_t* raster,
+	f32* depth_row, u32* color_row, i32 x_start, i32 x_end, f32 fy)
+{
+	f32 row_u = raster->u.b * fy + raster->u.c;
+	f32 row_v = raster->v.b * fy + raster->v.c;
+	f32 row_r = raster->r.b * fy + raster->r.c;
+	f32 row_g = raster->g.b * fy + raster->g.c;
+	f32 row_b = raster->b.b * fy + raster->b.c;
+	texture_t tex = raster->level;
+	texture_t tex_next = raster->level_next;
+	color_layout_t layout = triangle3d_raster_layout(raster);
+	render_stats_add(raster->stats, RENDER_STATS_PIXELS_SHADED,
+		x_end - x_start);
+
+	for (i32 x = x_start; x < x_end; x++) {
+		f32 fx = x + 0.5f;
+		f32 z = depth_row[x];
+		f32 u = (raster->u.a * fx + row_u) * z;
+		f32 v = (raster->v.a * fx + row_v) * z;
+		u32 texel = triangle3d_raster_sample(raster, &tex, &tex_next, u, v);
+		u32 a = texel_a(texel);
+		u32 r = texel_r(texel) * ((raster->r.a * fx + row_r) * z);
+		u32 g = texel_g(texel) * ((raster->g.a * fx + row_g) * z);
+		u32 b = texel_b(texel) * ((raster->b.a * fx + row_b) * z);
+		color_row[x] = color_pack(&layout, r, g, b, a);
+	}
+} // triangle3d_raster_shade_span
+
+#ifdef TRIANGLE3D_SSE2
+// Four pixel version of triangle3d_raster_shade_span with the same colors
+static inline void triangle3d_raster_shade_span_sse2(
+	triangle3d_raster_t* raster, f32* depth_row, u32* color_row, i32 x_start,
+	i32 x_end, f32 fy)
+{
+	__m128 row_u = _mm_set1_ps(raster->u.b * fy + raster->u.c);
+	__m128 row_v = _mm_set1_ps(raster->v.b * fy + raster->v.c);
+	__m128 row_r = _mm_set1_ps(raster->r.b * fy + raster->r.c);
+	__m128 row_g = _mm_set1_ps(raster->g.b * fy + raster->g.c);
+	__m128 row_b = _mm_set1_ps(raster->b.b * fy + raster->b.c);
+	__m128 u_a = _mm_set1_ps(raster->u.a);
+	__m128 v_a = _mm_set1_ps(raster->v.a);
+	__m128 r_a = _mm_set1_ps(raster->r.a);
+	__m128 g_a = _mm_set1_ps(raster->g.a);
+	__m128 b_a = _mm_set1_ps(raster->b.a);
+	__m128i channel_mask = _mm_set1_epi32(0xFF);
+	__m128 lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	color_layout_t layout = triangle3d_raster_layout(raster);
+
+	texture_t tex = raster->level;
+	texture_t tex_next = raster->level_next;
+	i32 nearest = raster->filter == TEXTURE_FILTER_NEAREST;
+	i32 wrap_pow2 = tex.address == TEXTURE_ADDRESS_WRAP &&
+		tex.width_shift >= 0;
+	__m128 scale_u = _mm_set1_ps(raster->level_scale_u);
+	__m128 scale_v = _mm_set1_ps(raster->level_scale_v);
+	__m128i width_mask = _mm_set1_epi32(tex.width_mask);
+	__m128i height_mask = _mm_set1_epi32(tex.height_mask);
+	__m128i width_shift = _mm_cvtsi32_si128(wrap_pow2 ? tex.width_shift : 0);
+
+	i32 x = x_start;
+	for (; x + 4 <= x_end; x += 4) {
+		__m128 fx = _mm_add_ps(_mm_set1_ps((f32) x), lane_offsets);
+		__m128 z = _mm_loadu_ps(&depth_row[x]);
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(u_a, fx), row_u), z);
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(v_a, fx), row_v), z);
+
+		__m128i texels;
+		if (nearest) {
+			__m128i tu = _mm_cvttps_epi32(_mm_mul_ps(u, scale_u));
+			__m128i tv = _mm_cvttps_epi32(_mm_mul_ps(v, scale_v));
+			i32 indices[4];
+			if (wrap_pow2) {
+				_mm_storeu_si128((__m128i *) indices, _mm_or_si128(
+					_mm_sll_epi32(_mm_and_si128(tv, height_mask),
+						width_shift),
+					_mm_and_si128(tu, width_mask)));
+			} else {
+				i32 tus[4], tvs[4];
+				_mm_storeu_si128((__m128i *) tus, tu);
+				_mm_storeu_si128((__m128i *) tvs, tv);
+				for (i32 i = 0; i < 4; i++)
+					indices[i] = texture_texel_index(&tex, tus[i], tvs[i]);
+			}
+			texels = _mm_setr_epi32(
+				tex.data[indices[0]], tex.data[indices[1]],
+				tex.data[indices[2]], tex.data[indices[3]]);
+		} else {
+			f32 us[4], vs[4];
+			u32 filtered[4];
+			_mm_storeu_ps(us, u);
+			_mm_storeu_ps(vs, v);
+			for (i32 i = 0; i < 4; i++) {
+				filtered[i] = triangle3d_raster_sample(raster, &tex,
+					&tex_next, us[i], vs[i]);
+			}
+			texels = _mm_loadu_si128((__m128i *) filtered);
+		}
+
+		__m128i a = _mm_srli_epi32(texels, 24);
+		__m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(
+			_mm_srli_epi32(texels, 16), channel_mask)), _mm_mul_ps(
+			_mm_add_ps(_mm_mul_ps(r_a, fx), row_r), z));
+		__m128 g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(
+			_mm_srli_epi32(texels, 8), channel_mask)), _mm_mul_ps(
+			_mm_add_ps(_mm_mul_ps(g_a, fx), row_g), z));
+		__m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(
+			texels, channel_mask)), _mm_mul_ps(
+			_mm_add_ps(_mm_mul_ps(b_a, fx), row_b), z));
+		__m128i color = triangle3d_pack_sse2(&layout, r, g, b, a);
+		_mm_storeu_si128((__m128i *) &color_row[x], color);
+	}
+	render_stats_add(raster->stats, RENDER_STATS_PIXELS_SHADED, x - x_start);
+
+	triangle3d_raster_shade_span(raster, depth_row, color_row, x, x_end, fy);
+} // triangle3d_raster_shade_span_sse2
+#endif
+
+// Half-space rasterizer for a set up triangle, see triangle3d_setup.
+// Pixels are sampled at their centers; edges shared by two triangles are
+// drawn once using the top-left rule. Blocks are aligned to the screen, so
+// splitting the triangle over several rectangles draws bit-identically.
+// Triangles and blocks behind the depth bounds of the framebuffer are
+// skipped; the rectangles of concurrent calls must not share a block.
+// Writes colors or, if visibility is set, the id to the visibility buffer.
+static inline void triangle3d_raster_rect(framebuffer_t* fb,
+	triangle3d_t* triangle, i32 x_min, i32 y_min, i32 x_max, i32 y_max,
+	render_stats_t* stats, i32 visibility, u32 id)
+{
+	point4d_t* p1 = &triangle->p1.position;
+	point4d_t* p2 = &triangle->p2.position;
+	point4d_t* p3 = &triangle->p3.position;
+
+	// Bounding box clipped to the rectangle
+	f32 bx_min = p1->x, bx_max = p1->x;
+	f32 by_min = p1->y, by_max = p1->y;
+	if (p2->x < bx_min) bx_min = p2->x;
+	if (p3->x < bx_min) bx_min = p3->x;
+	if (p2->x > bx_max) bx_max = p2->x;
+	if (p3->x > bx_max) bx_max = p3->x;
+	if (p2->y < by_min) by_min = p2->y;
+	if (p3->y < by_min) by_min = p3->y;
+	if (p2->y > by_max) by_max = p2->y;
+	if (p3->y > by_max) by_max = p3->y;
+	if (bx_min > (f32) x_min) x_min = (i32) bx_min;
+	if (by_min > (f32) y_min) y_min = (i32) by_min;
+	if (bx_max + 1.0f < (f32) x_max) x_max = (i32) bx_max + 1;
+	if (by_max + 1.0f < (f32) y_max) y_max = (i32) by_max + 1;
+	if (x_min >= x_max || y_min >= y_max) return;
+
+	triangle3d_raster_t raster;
+	if (!triangle3d_raster_setup(&raster, fb, triangle)) return;
+	raster.stats = stats;
+	raster.id = id;
+	// NOTE: The visibility pass only samples for the alpha test
+	i32 mipmapped = raster.texture.level_count > 1 &&
+		(!visibility || raster.alpha_test);
+
+	const i32 bs = TRIANGLE3D_BLOCK_SIZE;
+	const f32 block_extent = (f32) (bs - 1);
+	const i64 block_extent_fixed = (bs - 1) * TRIANGLE3D_SUBPIXEL_SCALE;
+	i32 block_x_start = x_min - x_min % bs;
+	i32 block_y_start = y_min - y_min % bs;
+
+	// NOTE: A pixel passes the depth test if depth * w >= 1, so a block
+	//       fails for sure if depth_max times an upper bound of w is below
+	//       one. The tolerance covers the rounding of the w plane.
+	f32* depth_max = fb->depth_max;
+	triangle3d_plane_t* w = &raster.w;
+	f32 w_tolerance = (absolute(w->a) * x_max + absolute(w->b) * y_max +
+		absolute(w->c)) * (1.0f / (1 << 20));
+	if (depth_max) {
+		f32 w_max = p1->z;
+		if (p2->z > w_max) w_max = p2->z;
+		if (p3->z > w_max) w_max = p3->z;
+		w_max += w_tolerance;
+
+		i32 visible = 0;
+		for (i32 by = block_y_start; by < y_max && !visible; by += bs) {
+			f32* depth_max_row = &depth_max[(by / bs) * fb->depth_blocks_x];
+			for (i32 bx = block_x_start; bx < x_max; bx += bs) {
+				if (!(depth_max_row[bx / bs] * w_max < 1.0f)) {
+					visible = 1;
+					break;
+				}
+			}
+		}
+		if (!visible) return;
+	}
+
+	for (i32 by = block_y_start; by < y_max; by += bs) {
+		for (i32 bx = block_x_start; bx < x_max; bx += bs) {
+			i32 block_index = (by / bs) * fb->depth_blocks_x + bx / bs;
+			if (depth_max) {
+				f32 w00 = triangle3d_plane_at(w, bx + 0.5f, by + 0.5f);
+				f32 dx = w->a * block_extent;
+				f32 dy = w->b * block_extent;
+				f32 w_max = w00 + ((dx > 0.0f) ? dx : 0.0f) +
+					((dy > 0.0f) ? dy : 0.0f) + w_tolerance;
+				if (depth_max[block_index] * w_max < 1.0f) continue;
+			}
+
+			i32 px_min = (bx > x_min) ? bx : x_min;
+			i32 py_min = (by > y_min) ? by : y_min;
+			i32 px_max = (bx + bs < x_max) ? bx + bs : x_max;
+			i32 py_max = (by + bs < y_max) ? by + bs : y_max;
+
+			// Classify the block against the edges using its corners,
+			// exact in 64 bits
+			i32 block_full = 1;
+			i32 block_empty = 0;
+			i32 edge_row[3];
+			for (i32 i = 0; i < 3; i++) {
+				triangle3d_edge_t* e = &raster.edges[i];
+				i64 e00 = triangle3d_edge_at(e, bx, by);
+				i64 dx = e->a * block_extent_fixed;
+				i64 dy = e->b * block_extent_fixed;
+				i64 e_max = e00 + ((dx > 0) ? dx : 0) + ((dy > 0) ? dy : 0);
+				i64 e_min = e00 + ((dx < 0) ? dx : 0) + ((dy < 0) ? dy : 0);
+				if (e_max < 0) block_empty = 1;
+				if (e_min >= 0) {
+					// NOTE: The whole block is inside of the edge
+					edge_row[i] = 0;
+					raster.edge_step_x[i] = 0;
+					raster.edge_step_y[i] = 0;
+				} else {
+					// NOTE: The edge crosses the block, so its values in
+					//       the block are small enough for 32 bits
+					block_full = 0;
+					edge_row[i] = (i32) triangle3d_edge_at(e, px_min, py_min);
+					raster.edge_step_x[i] = e->a * TRIANGLE3D_SUBPIXEL_SCALE;
+					raster.edge_step_y[i] = e->b * TRIANGLE3D_SUBPIXEL_SCALE;
+				}
+			}
+			if (block_empty) continue;
+
+			// NOTE: One level of detail per block, evaluated at its center
+			if (mipmapped) {
+				triangle3d_raster_select_level(&raster, bx + bs * 0.5f,
+					by + bs * 0.5f);
+			}
+
+			i32 written = 0;
+			i32* edges = block_full ? NULL : edge_row;
+			for (i32 y = py_min; y < py_max; y++) {
+				i32 row_offset = framebuffer_row_offset(fb, bx, y);
+				f32* depth_row = &fb->depth[row_offset];
+				u32* color_row = &fb->color[row_offset];
+				u32* id_row = visibility ? &fb->visibility[row_offset] : NULL;
+#ifdef TRIANGLE3D_SSE2
+				if (visibility) {
+					written |= triangle3d_raster_span_visibility_sse2(&raster,
+						depth_row, id_row, px_min, px_max, y + 0.5f, edges);
+				} else {
+					written |= triangle3d_raster_span_sse2(&raster,
+						depth_row, color_row, px_min, px_max, y + 0.5f,
+						edges);
+				}
+#else
+				if (visibility) {
+					written |= triangle3d_raster_span_visibility_scalar(
+						&raster, depth_row, id_row, px_min, px_max,
+						y + 0.5f, edges);
+				} else {
+					written |= triangle3d_raster_span_scalar(&raster,
+						depth_row, color_row, px_min, px_max, y + 0.5f,
+						edges);
+				}
+#endif
+				edge_row[0] += raster.edge_step_y[0];
+				edge_row[1] += raster.edge_step_y[1];
+				edge_row[2] += raster.edge_step_y[2];
+			}
+			if (written && depth_max)
+				framebuffer_update_depth_max(fb, bx / bs, by / bs);
+		}
+	}
+} // triangle3d_raster_rect
+
+// stats may be NULL, see triangle3d_raster_rect
+static inline void triangle3d_fill_edge_rect(framebuffer_t* fb,
+	triangle3d_t* triangle, i32 x_min, i32 y_min, i32 x_max, i32 y_max,
+	render_stats_t* stats)
+{
+	triangle3d_raster_rect(fb, triangle, x_min, y_min, x_max, y_max, stats,
+		0, 0);
+} // triangle3d_fill_edge_rect
+
+// Visibility pass of the triangle: writes its depth and id to the pixels
+// where it is visible, so that after all triangles the visibility buffer
+// holds the triangle that the color pass would have drawn last. The pixels
+// are then shaded with triangle3d_raster_shade_span. stats may be NULL.
+static inline void triangle3d_fill_visibility_rect(framebuffer_t* fb,
+	triangle3d_t* triangle, i32 x_min, i32 y_min, i32 x_max, i32 y_max,
+	u32 id, render_stats_t* stats)
+{
+	triangle3d_raster_rect(fb, triangle, x_min, y_min, x_max, y_max, stats,
+		1, id);
+} // triangle3d_fill_visibility_rect
+
+static inline void triangle3d_fill_edge(framebuffer_t* fb,
+	triangle3d_t* triangle)
+{
+	triangle3d_setup(triangle);
+	triangle3d_fill_edge_rect(fb, triangle, 0, 0, fb->width, fb->height,
+		NULL);
+} // triangle3d_fill_edge
+
+// Clips the polygon in clip space against the plane given as coefficients
+// of (x, y, z, w), a vertex is inside if the dot product is >= 0. Writes at
+// most in_count + 1 vertices to out and returns their count.
+static inline i32 triangle3d_clip(vertex3d_t* out, vertex3d_t* in,
+	vector4d_t* plane, i32 in_count)
 {
+	if (in_count == 0) return 0;
 	i32 vertex_count = 0;
 	vertex3d_t* in_vertex = in;
 	vertex3d_t* out_vertex = out;
 
-	f32 current_dot = vector3d_dot_product(&in[0].position.xyz, &p->normal);
-	i32 current_inside = (current_dot >= p->distance);
+	f32 current_dot = vector4d_dot_product(&in[0].position, plane);
+	i32 current_inside = (current_dot >= 0.0f);
 
 	for (i32 i = 0; i < in_count; i++) {
-		i32 next_vert = (i + 1) % in_count;
+		i32 next_vert = (i + 1 < in_count) ? i + 1 : 0;
 
 		if (current_inside) {
 			*out_vertex = *in_vertex;
@@ -138,14 +1166,11 @@ static inline i32 triangle3d_clip(vertex3d_t* out, vertex3d_t* in, plane3d_t* p,
 			vertex_count++;
 		}
 
-		f32 next_dot = vector3d_dot_product(
-			&in[next_vert].position.xyz, &p->normal
-		);
-		i32 next_inside = (next_dot >= p->distance);
+		f32 next_dot = vector4d_dot_product(&in[next_vert].position, plane);
+		i32 next_inside = (next_dot >= 0.0f);
 
 		if (current_inside != next_inside) {
-			f32 t = (p->distance - current_dot) / 
-				(next_dot - current_dot);
+			f32 t = current_dot / (current_dot - next_dot);
 			vertex3d_lerp(out_vertex, in_vertex, &in[next_vert], t);
 			out_vertex++;
 			vertex_count++;
@@ -63,6 +63,7 @@ static inline void vertex3d_translate(vertex3d_t* out, vertex3d_t* in,
 	out->normal.x = in->normal.x + trans->x;
 	out->normal.y = in->normal.y + trans->y;
 	out->normal.z = in->normal.z + trans->z;
+	out->normal.w = in->normal.w;
 	vector3d_normalize(&out->normal.xyz, &out->normal.xyz);
 	out->color = in->color;
 } // vertex3d_translate
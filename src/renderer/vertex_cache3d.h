@@ -0,0 +1,114 @@
+#ifndef VERTEX_CACHE3D_H
+#define VERTEX_CACHE3D_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../math/mathlib.h"
+
+#include "face3d.h"
+#include "index3d.h"
+#include "vertex3d.h"
+
+// D E F I N E S ///////////////////////////////////////////////////////////////
+
+#define VERTEX_CACHE3D_EMPTY 0xFFFFFFFF
+
+// S T R U C T S ///////////////////////////////////////////////////////////////
+
+// NOTE: Every unique position/texcoord/normal triple of an entity is
+//       processed once per frame into camera and screen space; the faces
+//       refer to it through face3d_t.cache_indices. clip_codes holds the
+//       clip space outcodes of every vertex, see render_entity_clip_code.
+typedef struct vertex_cache3d_t {
+	u32 count;
+	index3d_t* keys;
+	vertex3d_t* camera;
+	vertex3d_t* screen;
+	u16* clip_codes;
+	u32* face_indices;
+} vertex_cache3d_t;
+
+// F U N C T I O N S ///////////////////////////////////////////////////////////
+
+static inline u32 vertex_cache3d_hash(index3d_t* index) {
+	u32 h = (u32) index->position * 73856093u;
+	h ^= (u32) index->texcoord * 19349663u;
+	h ^= (u32) index->normal * 83492791u;
+	return h;
+} // vertex_cache3d_hash
+
+// Allocates the per frame camera and screen space vertices for count
+// unique vertices; keys and face_indices can come from elsewhere
+static inline void vertex_cache3d_alloc_frame_data(vertex_cache3d_t* cache) {
+	u32 count = cache->count ? cache->count : 1;
+	cache->camera = malloc(sizeof *cache->camera * count);
+	cache->screen = malloc(sizeof *cache->screen * count);
+	cache->clip_codes = malloc(sizeof *cache->clip_codes * count);
+} // vertex_cache3d_alloc_frame_data
+
+// Collects the unique index triples of the faces and points the
+// cache_indices of every face into one contiguous array
+static inline void vertex_cache3d_build(vertex_cache3d_t* cache,
+	face3d_t* faces, u32 face_count)
+{
+	u32 index_count = 0;
+	for (u32 i = 0; i < face_count; i++)
+		index_count += faces[i].index_count;
+
+	u32 table_size = 16;
+	while (table_size < index_count * 2) table_size <<= 1;
+	u32* table = malloc(sizeof *table * table_size);
+	memset(table, 0xFF, sizeof *table * table_size);
+
+	cache->count = 0;
+	cache->keys = malloc(sizeof *cache->keys * (index_count ? index_count : 1));
+	cache->face_indices = malloc(sizeof *cache->face_indices *
+		(index_count ? index_count : 1));
+
+	u32* face_indices = cache->face_indices;
+	for (u32 i = 0; i < face_count; i++) {
+		face3d_t* face = &faces[i];
+		face->cache_indices = face_indices;
+		for (u32 j = 0; j < face->index_count; j++) {
+			index3d_t* key = &face->indices[j];
+			u32 slot = vertex_cache3d_hash(key) & (table_size - 1);
+			while (table[slot] != VERTEX_CACHE3D_EMPTY) {
+				index3d_t* other = &cache->keys[table[slot]];
+				if (other->position == key->position &&
+					other->texcoord == key->texcoord &&
+					other->normal == key->normal) break;
+				slot = (slot + 1) & (table_size - 1);
+			}
+			if (table[slot] == VERTEX_CACHE3D_EMPTY) {
+				table[slot] = cache->count;
+				cache->keys[cache->count++] = *key;
+			}
+			face_indices[j] = table[slot];
+		}
+		face_indices += face->index_count;
+	}
+	free(table);
+
+	u32 count = cache->count ? cache->count : 1;
+	cache->keys = realloc(cache->keys, sizeof *cache->keys * count);
+	vertex_cache3d_alloc_frame_data(cache);
+} // vertex_cache3d_build
+
+static inline void vertex_cache3d_free_frame_data(vertex_cache3d_t* cache) {
+	free(cache->camera);
+	free(cache->screen);
+	free(cache->clip_codes);
+	cache->camera = NULL;
+	cache->screen = NULL;
+	cache->clip_codes = NULL;
+} // vertex_cache3d_free_frame_data
+
+static inline void vertex_cache3d_free(vertex_cache3d_t* cache) {
+	free(cache->keys);
+	free(cache->face_indices);
+	vertex_cache3d_free_frame_data(cache);
+	memset(cache, 0, sizeof *cache);
+} // vertex_cache3d_free
+
+#endif // VERTEX_CACHE3D_H